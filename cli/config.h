@@ -0,0 +1,93 @@
+#ifndef POPS_CLI_CONFIG_H
+#define POPS_CLI_CONFIG_H
+
+// Run configuration of the command-line engine: one "name = value" per line,
+// with the parameter names of pest() / pest_vars (host1_rast, sporeRate,
+// kernelType, ...). '#' starts a comment; values may be quoted. Unknown names
+// are refused so that a misspelled parameter does not silently fall back to
+// its default.
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+namespace pops {
+namespace cli {
+
+class Config {
+public:
+  explicit Config(const std::string& path){
+    std::ifstream in(path.c_str());
+    if (!in) throw std::runtime_error("cannot open the configuration file " + path);
+    std::string line;
+    int number = 0;
+    while (std::getline(in, line)){
+      number++;
+      std::size_t hash = line.find('#');
+      if (hash != std::string::npos) line.erase(hash);
+      line = trim(line);
+      if (line.empty()) continue;
+      std::size_t eq = line.find('=');
+      if (eq == std::string::npos)
+        throw std::runtime_error(path + ":" + std::to_string(number) + ": expected name = value");
+      std::string name = trim(line.substr(0, eq)), value = trim(line.substr(eq + 1));
+      if (value.size() >= 2 && (value[0] == '"' || value[0] == '\'') && value[value.size() - 1] == value[0])
+        value = value.substr(1, value.size() - 2);
+      values_[name] = value;
+    }
+  }
+
+  // refuse names that are not in 'known'
+  void check(const std::set<std::string>& known) const {
+    for (std::map<std::string, std::string>::const_iterator it = values_.begin(); it != values_.end(); ++it)
+      if (!known.count(it->first)) throw std::runtime_error("unknown parameter '" + it->first + "' in the configuration");
+  }
+
+  bool has(const std::string& name) const {
+    std::map<std::string, std::string>::const_iterator it = values_.find(name);
+    return it != values_.end() && !it->second.empty() && it->second != "NULL" && it->second != "NA";
+  }
+
+  std::string text(const std::string& name, const std::string& fallback = "") const {
+    return has(name) ? values_.find(name)->second : fallback;
+  }
+
+  std::string required(const std::string& name) const {
+    if (!has(name)) throw std::runtime_error("the parameter " + name + " must be given");
+    return values_.find(name)->second;
+  }
+
+  double number(const std::string& name, double fallback) const {
+    if (!has(name)) return fallback;
+    const std::string& v = values_.find(name)->second;
+    char* end;
+    double x = std::strtod(v.c_str(), &end);
+    if (end == v.c_str() || *end) throw std::runtime_error("the parameter " + name + " must be a number");
+    return x;
+  }
+
+  // 'YES'/'NO' flags of pest() (TRUE/FALSE are accepted too)
+  bool flag(const std::string& name, bool fallback) const {
+    if (!has(name)) return fallback;
+    const std::string& v = values_.find(name)->second;
+    if (v == "YES" || v == "TRUE" || v == "yes" || v == "true" || v == "1") return true;
+    if (v == "NO" || v == "FALSE" || v == "no" || v == "false" || v == "0") return false;
+    throw std::runtime_error("the parameter " + name + " must be YES or NO");
+  }
+
+private:
+  static std::string trim(const std::string& s){
+    std::size_t a = s.find_first_not_of(" \t\r"), b = s.find_last_not_of(" \t\r");
+    return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+  }
+
+  std::map<std::string, std::string> values_;
+};
+
+} // namespace cli
+} // namespace pops
+
+#endif
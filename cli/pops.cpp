@@ -0,0 +1,651 @@
+// Command-line simulation engine.
+//
+//   pops <config file>
+//
+// Runs the native engine (scripts/engine/, the same code as pestJobStart) from
+// a configuration file holding the parameters of pest() (see config.h), with
+// no R session. Hosts come from rasters (host1_rast, ..., allTrees,
+// initialPopulation) or from a landscape pack (landscape = file written by
+// landscapePack()); weather coefficients are read one layer per active step
+// while the run goes on (tempData / precipData, critTempData, windDirData).
+//
+// Outputs go to the directory 'output': the infected hosts of every output
+// year (infected_<year>.asc or .tif, and infected_<year>_host<h> per host with
+// several hosts) and summary.csv (year, host, infected individuals, infected
+// cells, infected area). With zones = a raster of zone numbers (0 outside,
+// as written by zoneIndex()), zonal.csv gives the same per zone. window.csv
+// gives the part of the study area the run used up to each output year (the
+// weather is only read there); with output_window = YES the rasters are
+// cropped to it.
+//
+// With domains = n the study area runs as n row strips on as many threads.
+// Built with POPS_WITH_MPI and started under mpirun, every MPI process runs one
+// strip (see MpiExchange); the result is the same as a single process. Each
+// process reads only the rows of its strip, and the outputs are written strip
+// after strip by rank 0, so no process holds a whole grid of the study area.
+// threads = n disperses the spores of each strip on n threads (OpenMP builds),
+// and with concurrent_landing = YES also applies the infections on n threads
+// (not reproducible for a seed). aggregate_landings = YES draws the infections
+// of the spores landing in a cell together (see SpreadParams).
+// common_random_numbers = YES keeps the random numbers of each spore the same
+// across parameter sets for a seed, and antithetic = YES runs the antithetic
+// twin of a seed (see SpreadParams), to compare parameter sets in calibration.
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "raster_io.h"
+
+#include "decomposition.h"
+#include "kernel_table.h"
+#include "landscape_pack.h"
+#include "schedule.h"
+#include "simulation.h"
+#include "zones.h"
+
+#ifdef POPS_WITH_MPI
+#include <mpi.h>
+#endif
+
+using namespace pops;
+using pops::cli::Config;
+using pops::cli::Grid;
+
+namespace {
+
+const char* PARAMETERS[] = {
+  "host1_rast", "host2_rast", "host3_rast", "host4_rast", "host5_rast", "host6_rast", "host7_rast", "host8_rast",
+  "host9_rast", "host10_rast", "host1_score", "host2_score", "host3_score", "host4_score", "host5_score",
+  "host6_score", "host7_score", "host8_score", "host9_score", "host10_score", "allTrees", "initialPopulation",
+  "landscape", "start", "end", "seasonality", "s1", "s2", "sporeRate", "windQ", "windDir", "tempQ", "tempData",
+  "precipQ", "precipData", "kernelType", "kappa", "number_of_hosts", "scale1", "scale2", "gamma", "shape",
+  "seed_n", "time_step", "mortalityQ", "critTempData", "lethal_temp", "mortality_date", "windDirData",
+  "windKappaData", "domains", "threads", "concurrent_landing", "aggregate_landings",
+  "common_random_numbers", "antithetic",
+  "kernel_table", "output_window", "output", "output_format", "zones"
+};
+
+std::string host_key(int h, const char* what){
+  return "host" + std::to_string(h + 1) + "_" + what;
+}
+
+// host counts of a raster: missing values are 0
+std::vector<int> counts(const Grid& g){
+  std::vector<int> out(g.values.size());
+  for (std::size_t k = 0; k < out.size(); k++){
+    float v = g.values[k];
+    out[k] = std::isnan(v) || v < 0 ? 0 : int(std::floor(v + 0.5));
+  }
+  return out;
+}
+
+// Weather layers read from the coefficient files as the run reaches them.
+// Strips ask for the layer of a step from their own threads; no strip is more
+// than one step ahead of another (they meet at every exchange), so only the
+// last few steps are kept. Only the window of the study area the step needs is
+// read (see WeatherSource::suitability_in); a later request for a larger window
+// reads the missing cells and leaves those already read untouched, as other
+// strips may be using them.
+// With rows [row0, row1) (an MPI process) the layers hold only those rows, and
+// the part of a window outside of them is not read.
+class FileWeather : public WeatherSource {
+public:
+  FileWeather(const Config& config, const Grid& shape, int row0 = 0, int row1 = -1)
+    : config_(config), shape_(shape), row0_(row0), row1_(row1 < 0 ? shape.nrow : row1){
+    temp_ = config.flag("tempQ", false);
+    precip_ = config.flag("precipQ", false);
+    mortality_ = config.flag("mortalityQ", false);
+    start_ = int(config.number("start", 0));
+    if (temp_) config.required("tempData");
+    if (precip_) config.required("precipData");
+    if (mortality_) config.required("critTempData");
+  }
+
+  const float* suitability(int step){ return suitability_in(step, all()); }
+  const float* crit_temp(int year){ return crit_temp_in(year, all()); }
+  WindField wind(int step){ return wind_in(step, all()); }
+
+  const float* suitability_in(int step, const Window& window){
+    if (!temp_ && !precip_) return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return extend(layer(suitability_, step), window, [&](const Window& w, std::vector<float>& values){
+      if (precip_) read(config_.required("precipData"), step, "Mcoef", w, values);
+      if (temp_){
+        if (!precip_){
+          read(config_.required("tempData"), step, "Ccoef", w, values);
+        }else{
+          read(config_.required("tempData"), step, "Ccoef", w, scratch_);
+          for_cells(w, [&](std::size_t k){ values[k] *= scratch_[k]; });
+        }
+      }
+      for_cells(w, [&](std::size_t k){ if (std::isnan(values[k])) values[k] = 0; });
+    });
+  }
+
+  const float* crit_temp_in(int year, const Window& window){
+    if (!mortality_) return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    // missing temperatures never trigger mortality: NaN is kept
+    return extend(layer(crit_temp_, year), window, [&](const Window& w, std::vector<float>& values){
+      read(config_.required("critTempData"), year - start_ + 1, "", w, values);
+    });
+  }
+
+  WindField wind_in(int step, const Window& window){
+    if (!config_.has("windDirData")) return WindField();
+    std::lock_guard<std::mutex> lock(mutex_);
+    const float* direction = extend(layer(wind_dir_, step), window, [&](const Window& w, std::vector<float>& values){
+      read(config_.required("windDirData"), step, "wind_dir", w, values);
+    });
+    const float* kappa = 0;
+    if (config_.has("windKappaData"))
+      kappa = extend(layer(wind_kappa_, step), window, [&](const Window& w, std::vector<float>& values){
+        read(config_.required("windKappaData"), step, "kappa", w, values);
+      });
+    return WindField(direction, kappa);
+  }
+
+private:
+  // a layer and the window of it read so far
+  struct Layer {
+    std::vector<float> values;
+    Window read;
+  };
+
+  Window all() const { return Window(row0_, row1_, 0, shape_.ncol); }
+
+  // the part of a window in the rows of the layers
+  Window clip(const Window& w) const {
+    Window c(std::max(w.row0, row0_), std::min(w.row1, row1_), w.col0, w.col1);
+    return c.empty() ? Window() : c;
+  }
+
+  void read(const std::string& path, int band, const std::string& varid, const Window& w, std::vector<float>& values){
+    cli::read_window(path, band, cli::extension(path) == ".nc" ? varid : "", w, shape_.nrow, shape_.ncol, values, row0_);
+  }
+
+  template <typename F>
+  void for_cells(const Window& w, F f) const {
+    for (int i = w.row0; i < w.row1; i++)
+      for (int j = w.col0; j < w.col1; j++) f(std::size_t(i - row0_) * shape_.ncol + j);
+  }
+
+  // the layer of a step (or year), the layers of older steps dropped
+  Layer& layer(std::map<int, Layer>& layers, int key){
+    std::map<int, Layer>::iterator it = layers.find(key);
+    if (it != layers.end()) return it->second;
+    while (layers.size() >= 3 && layers.begin()->first < key) layers.erase(layers.begin());
+    Layer& l = layers[key];
+    l.values.assign(std::size_t(row1_ - row0_) * shape_.ncol, NAN);
+    return l;
+  }
+
+  // read(w, values) reads the window w into values (the size of a layer); the
+  // bounding window of what was read and 'window' is read into scratch and its
+  // new cells copied into the layer
+  template <typename F>
+  const float* extend(Layer& layer, const Window& window, F read){
+    Window want = layer.read;
+    want.include(clip(window));
+    if (!layer.read.contains(want)){
+      scratch_values_.resize(layer.values.size());
+      scratch_.resize(layer.values.size());
+      read(want, scratch_values_);
+      for_cells(want, [&](std::size_t k){
+        int row = row0_ + int(k / shape_.ncol), col = int(k % shape_.ncol);
+        if (!layer.read.contains(row, col)) layer.values[k] = scratch_values_[k];
+      });
+      layer.read = want;
+    }
+    return &layer.values[0];
+  }
+
+  const Config& config_;
+  Grid shape_;
+  int row0_, row1_;
+  bool temp_, precip_, mortality_;
+  int start_;
+  std::mutex mutex_;
+  std::map<int, Layer> suitability_, crit_temp_, wind_dir_, wind_kappa_;
+  std::vector<float> scratch_values_, scratch_;   // whole layers, only the window being read is used
+};
+
+// writes the outputs of every output year (on a single process, or on rank 0).
+// The infected hosts of a year come strip by strip in order of rows: begin(),
+// rows() for every strip, then end(); the rasters are written as the rows
+// come, so the writer never holds a whole grid.
+class OutputWriter {
+public:
+  OutputWriter(const Config& config, const Grid& geometry, int nhosts)
+    : geometry_(geometry), nhosts_(nhosts), year_(0), next_row_(0){
+    dir_ = config.text("output", "output");
+    format_ = config.text("output_format", "asc");
+    if (format_ != "asc" && format_ != "tif") throw std::runtime_error("output_format must be asc or tif");
+    crop_ = config.flag("output_window", false);
+    summary_ = std::fopen((dir_ + "/summary.csv").c_str(), "w");
+    if (!summary_) throw std::runtime_error("cannot create " + dir_ + "/summary.csv (does the output directory exist?)");
+    std::fprintf(summary_, "year,host,infected,infected_cells,infected_area\n");
+    window_ = std::fopen((dir_ + "/window.csv").c_str(), "w");
+    if (!window_) throw std::runtime_error("cannot create " + dir_ + "/window.csv");
+    std::fprintf(window_, "year,row_min,row_max,col_min,col_max,xmin,xmax,ymin,ymax,fraction\n");
+    zonal_ = 0;
+    if (config.has("zones")){
+      zonal_ = std::fopen((dir_ + "/zonal.csv").c_str(), "w");
+      if (!zonal_) throw std::runtime_error("cannot create " + dir_ + "/zonal.csv");
+      std::fprintf(zonal_, "year,zone,host,infected,infected_cells,infected_area\n");
+    }
+  }
+  ~OutputWriter(){
+    if (summary_) std::fclose(summary_);
+    if (window_) std::fclose(window_);
+    if (zonal_) std::fclose(zonal_);
+  }
+
+  // 'window': the part of the study area the run used so far (see
+  // Simulation::touched_window()), to which rasters are cropped with output_window
+  void begin(int year, const Window& window){
+    year_ = year;
+    touched_ = window;
+    out_ = crop_ && !window.empty() ? window : Window(0, geometry_.nrow, 0, geometry_.ncol);
+    Grid shape = geometry_.crop(out_);
+    rasters_.clear();
+    rasters_.push_back(std::unique_ptr<cli::GridWriter>(new cli::GridWriter(name(year, 0), shape)));
+    if (nhosts_ > 1)
+      for (int h = 0; h < nhosts_; h++)
+        rasters_.push_back(std::unique_ptr<cli::GridWriter>(new cli::GridWriter(name(year, h + 1), shape)));
+    infected_.assign(nhosts_, 0);
+    cells_.assign(nhosts_, 0);
+    next_row_ = 0;
+  }
+
+  // the infected hosts of the rows from row0 on (I[h]: whole rows of host h),
+  // right after those of the rows above
+  void rows(int row0, const std::vector<std::vector<int> >& I){
+    if (row0 != next_row_) throw std::logic_error("output rows written out of order");
+    int ncol = geometry_.ncol, n = int(I[0].size() / ncol);
+    for (int h = 0; h < nhosts_; h++)
+      for (std::size_t k = 0; k < I[h].size(); k++)
+        if (I[h][k] > 0){
+          infected_[h] += I[h][k];
+          cells_[h]++;
+        }
+    // rows of the block in the rasters
+    int first = std::max(row0, out_.row0), last = std::min(row0 + n, out_.row1);
+    if (first < last){
+      std::size_t size = std::size_t(last - first) * out_.ncol();
+      std::vector<float> total(size, 0.0f), host(size);
+      for (int h = 0; h < nhosts_; h++){
+        for (int i = first; i < last; i++)
+          for (int j = out_.col0; j < out_.col1; j++){
+            int v = I[h][std::size_t(i - row0) * ncol + j];
+            std::size_t k = std::size_t(i - first) * out_.ncol() + j - out_.col0;
+            host[k] = v > 0 ? float(v) : NAN;
+            if (v > 0) total[k] += float(v);
+          }
+        if (nhosts_ > 1) rasters_[h + 1]->rows(&host[0], last - first);
+      }
+      for (std::size_t k = 0; k < size; k++) if (total[k] == 0) total[k] = NAN;
+      rasters_[0]->rows(&total[0], last - first);
+    }
+    next_row_ = row0 + n;
+  }
+
+  // once every row is written; 'zones': the zonal summary of the year, with zones
+  void end(const pops::ZonalSummary* zones){
+    for (std::size_t r = 0; r < rasters_.size(); r++) rasters_[r]->close();
+    rasters_.clear();
+    double cell_area = geometry_.xres * geometry_.yres;
+    for (int h = 0; h < nhosts_; h++)
+      std::fprintf(summary_, "%d,%d,%ld,%ld,%.10g\n", year_, h + 1, infected_[h], cells_[h], cells_[h] * cell_area);
+    std::fflush(summary_);
+    write_window(year_, touched_);
+    if (zones) write_zones(year_, *zones);
+    std::fprintf(stderr, "year %d written\n", year_);
+  }
+
+private:
+  // rows and columns from 1, as in R
+  void write_window(int year, const Window& w){
+    if (w.empty()){
+      std::fprintf(window_, "%d,,,,,,,,,0\n", year);
+    }else{
+      double xmin = geometry_.xmin + w.col0 * geometry_.xres, ymax = geometry_.ymax - w.row0 * geometry_.yres;
+      std::fprintf(window_, "%d,%d,%d,%d,%d,%.10g,%.10g,%.10g,%.10g,%.6g\n", year, w.row0 + 1, w.row1, w.col0 + 1, w.col1,
+                   xmin, xmin + w.ncol() * geometry_.xres, ymax - w.nrow() * geometry_.yres, ymax,
+                   double(w.cells()) / (double(geometry_.nrow) * geometry_.ncol));
+    }
+    std::fflush(window_);
+  }
+
+  // zones with infected hosts; host 0 is all hosts
+  void write_zones(int year, const pops::ZonalSummary& z){
+    double cell_area = geometry_.xres * geometry_.yres;
+    for (int zone = 1; zone <= z.nzones; zone++){
+      long cells = z.infected_cells(zone);
+      if (cells == 0) continue;
+      long all = 0;
+      for (int h = 0; h < nhosts_; h++) all += z.infected(zone, h);
+      std::fprintf(zonal_, "%d,%d,0,%ld,%ld,%.10g\n", year, zone, all, cells, cells * cell_area);
+      if (nhosts_ > 1)
+        for (int h = 0; h < nhosts_; h++)
+          std::fprintf(zonal_, "%d,%d,%d,%ld,,\n", year, zone, h + 1, z.infected(zone, h));
+    }
+    std::fflush(zonal_);
+  }
+
+  std::string name(int year, int host) const {
+    std::string n = dir_ + "/infected_" + std::to_string(year);
+    if (host > 0) n += "_host" + std::to_string(host);
+    return n + "." + format_;
+  }
+
+  Grid geometry_;
+  int nhosts_;
+  std::string dir_, format_;
+  bool crop_;
+  std::FILE* summary_;
+  std::FILE* window_;
+  std::FILE* zonal_;
+  // the year being written
+  int year_, next_row_;
+  Window touched_, out_;
+  std::vector<std::unique_ptr<cli::GridWriter> > rasters_;   // all hosts, then host 1.. with several hosts
+  std::vector<long> infected_, cells_;
+};
+
+// zonal summary of the infected hosts of a simulation (or strip)
+pops::ZonalSummary summarize(const pops::ZoneIndex& zones, const Simulation& sim){
+  std::vector<pops::SparseLayer> layers;
+  for (int h = 0; h < sim.nhosts(); h++) layers.push_back(pops::SparseLayer::encode(sim.infected(h)));
+  return zones.summarize(layers);
+}
+
+class LocalObserver : public StepObserver {
+public:
+  // 'zones': the zones of the study area, null without zones
+  LocalObserver(OutputWriter& writer, const pops::ZoneIndex* zones) : writer_(writer), zones_(zones) {}
+  void output(const ScheduledStep& e, const Simulation& sim){
+    std::vector<std::vector<int> > I;
+    for (int h = 0; h < sim.nhosts(); h++) I.push_back(sim.infected(h));
+    writer_.begin(e.date.year, sim.touched_window());
+    writer_.rows(0, I);
+    if (zones_){
+      pops::ZonalSummary z = summarize(*zones_, sim);
+      writer_.end(&z);
+    }else{
+      writer_.end(0);
+    }
+  }
+
+private:
+  OutputWriter& writer_;
+  const pops::ZoneIndex* zones_;
+};
+
+#ifdef POPS_WITH_MPI
+// Sends the strips to rank 0 at every output year, which writes them in order
+// of rows as they arrive: rank 0 holds its own strip and one other strip at a
+// time, never the whole study area. Zonal summaries are made on every strip
+// and summed on rank 0.
+class MpiObserver : public StepObserver {
+public:
+  // 'zones': the zones of the strip, null without zones
+  MpiObserver(OutputWriter* writer, const pops::ZoneIndex* zones, const std::vector<int>& bounds, int ncol, int rank)
+    : writer_(writer), zones_(zones), bounds_(bounds), ncol_(ncol), rank_(rank) {}
+  void output(const ScheduledStep& e, const Simulation& sim){
+    int parts = int(bounds_.size()) - 1;
+    // union of the windows of the strips
+    const Window& w = sim.touched_window();
+    int low[2] = {w.empty() ? INT_MAX : w.row0, w.empty() ? INT_MAX : w.col0}, high[2] = {w.row1, w.col1};
+    int row_col0[2], row_col1[2];
+    MPI_Reduce(low, row_col0, 2, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(high, row_col1, 2, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    pops::ZonalSummary zonal;
+    if (zones_){
+      pops::ZonalSummary z = summarize(*zones_, sim);
+      zonal = z;
+      MPI_Reduce(&z.hosts[0], &zonal.hosts[0], int(z.hosts.size()), MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+      MPI_Reduce(&z.cells[0], &zonal.cells[0], int(z.cells.size()), MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+    if (rank_ != 0){
+      for (int h = 0; h < sim.nhosts(); h++){
+        const std::vector<int>& strip = sim.infected(h);
+        MPI_Send(const_cast<int*>(&strip[0]), count(strip.size()), MPI_INT, 0, h, MPI_COMM_WORLD);
+      }
+      return;
+    }
+    Window touched;
+    if (row_col0[0] != INT_MAX) touched = Window(row_col0[0], row_col1[0], row_col0[1], row_col1[1]);
+    writer_->begin(e.date.year, touched);
+    std::vector<std::vector<int> > I(sim.nhosts());
+    for (int h = 0; h < sim.nhosts(); h++) I[h] = sim.infected(h);
+    writer_->rows(bounds_[0], I);
+    for (int p = 1; p < parts; p++){
+      for (int h = 0; h < sim.nhosts(); h++){
+        I[h].resize(std::size_t(bounds_[p + 1] - bounds_[p]) * ncol_);
+        MPI_Recv(&I[h][0], count(I[h].size()), MPI_INT, p, h, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      }
+      writer_->rows(bounds_[p], I);
+    }
+    writer_->end(zones_ ? &zonal : 0);
+  }
+
+private:
+  // MPI counts are int: a strip of more cells cannot be sent in one message
+  static int count(std::size_t n){
+    if (n > std::size_t(INT_MAX)) throw std::overflow_error("a strip has too many cells for an MPI message");
+    return int(n);
+  }
+
+  OutputWriter* writer_;
+  const pops::ZoneIndex* zones_;
+  std::vector<int> bounds_;
+  int ncol_, rank_;
+};
+#endif
+
+ScheduleOptions schedule_options(const Config& config){
+  ScheduleOptions o;
+  o.start_year = int(config.number("start", 0));
+  o.end_year = int(config.number("end", 0));
+  if (o.start_year > o.end_year) throw std::runtime_error("start date must precede end date!!");
+  std::string ts = config.text("time_step", "weeks");
+  o.unit = step_unit(ts);
+  o.seasonality = config.flag("seasonality", false);
+  o.s1 = int(config.number("s1", 1));
+  o.s2 = int(config.number("s2", 12));
+  o.output_month = ts == "months" ? o.s2 : 9;
+  o.mortality = config.flag("mortalityQ", false);
+  std::string md = config.text("mortality_date", "01-01");
+  if (md.size() != 5 || md[2] != '-') throw std::runtime_error("mortality_date must be given as \"MM-DD\"");
+  o.mortality_month = std::atoi(md.substr(0, 2).c_str());
+  o.mortality_day = std::atoi(md.substr(3, 2).c_str());
+  return o;
+}
+
+SpreadParams spread_params(const Config& config, double res){
+  SpreadParams params;
+  params.res = res;
+  params.spore_rate = config.number("sporeRate", NAN);
+  if (std::isnan(params.spore_rate)) throw std::runtime_error("the parameter sporeRate must be given");
+  params.seed = uint64_t(config.number("seed_n", 42));
+  params.threads = int(config.number("threads", 1));
+  params.concurrent_landing = config.flag("concurrent_landing", false);
+  params.aggregate_landings = config.flag("aggregate_landings", false);
+  params.common_random_numbers = config.flag("common_random_numbers", false);
+  params.antithetic = config.flag("antithetic", false);
+  params.kernel.type = kernel_type(config.text("kernelType", "Cauchy"));
+  params.kernel.scale1 = config.number("scale1", 20.57);
+  params.kernel.scale2 = config.number("scale2", 0);
+  params.kernel.gamma = config.number("gamma", 1);
+  params.kernel.shape = config.number("shape", 0);
+  params.kernel.wind = config.flag("windQ", false);
+  params.kernel.kappa = config.number("kappa", 2);
+  params.kernel.wind_dir = params.kernel.wind ? wind_direction(config.required("windDir")) * pi / 180 : 0;
+  if (config.flag("kernel_table", true)) params.table = kernel_cache().get(params.kernel, params.res);
+  return params;
+}
+
+// size and georeference of the study area (the host grids), without reading them
+Grid study_area(const Config& config){
+  Grid geometry;
+  if (config.has("landscape")){
+    LandscapePack pack(config.required("landscape"), false);
+    PackGeometry g = pack.geometry();
+    geometry.nrow = pack.nrow();
+    geometry.ncol = pack.ncol();
+    geometry.xmin = g.xmin;
+    geometry.ymax = g.ymax;
+    geometry.xres = (g.xmax - g.xmin) / pack.ncol();
+    geometry.yres = (g.ymax - g.ymin) / pack.nrow();
+    geometry.crs = g.crs;
+  }else{
+    geometry = cli::read_header(config.required("allTrees"));
+  }
+  return geometry;
+}
+
+// rows [row0, row1) of the raster of a parameter, which must have the
+// dimensions of the study area
+Grid raster_rows(const Config& config, const std::string& key, const Grid& geometry, int row0, int row1,
+                 const char* mismatch){
+  std::string path = config.required(key);
+  if (!cli::read_header(path).same_shape(geometry)) throw std::runtime_error(mismatch);
+  return cli::read_rows(path, row0, row1);
+}
+
+// the rows [row0, row1) of the study area at the start of the run, as a strip
+// of the whole area (all rows by default); verify = false skips the checksum
+// of a landscape pack
+Simulation load(const Config& config, const Grid& geometry, int row0 = 0, int row1 = -1, bool verify = true){
+  if (row1 < 0) row1 = geometry.nrow;
+  int nhosts = int(config.number("number_of_hosts", 1));
+  if (nhosts < 1 || nhosts > 10) throw std::runtime_error("number_of_hosts must range between 1 and 10");
+  std::vector<double> score;
+  for (int h = 0; h < nhosts; h++){
+    double s = config.number(host_key(h, "score"), NAN);
+    if (std::isnan(s)) throw std::runtime_error("a host score must be given for each of the number_of_hosts hosts");
+    score.push_back(s / 10.0);
+  }
+  std::vector<std::vector<int> > S, I;
+  std::vector<int> all_trees;
+  if (config.has("landscape")){
+    LandscapePack pack(config.required("landscape"), verify);
+    pack.initial_state(nhosts, S, I, row0, row1);
+    all_trees = pack.all_trees(row0, row1);
+  }else{
+    all_trees = counts(cli::read_rows(config.required("allTrees"), row0, row1));
+    std::vector<int> init = counts(raster_rows(config, "initialPopulation", geometry, row0, row1,
+                                               "initialPopulation and allTrees must have the same dimensions"));
+    for (int h = 0; h < nhosts; h++){
+      S.push_back(counts(raster_rows(config, host_key(h, "rast"), geometry, row0, row1,
+                                     "host rasters and allTrees must have the same dimensions")));
+      I.push_back(std::vector<int>());
+      initial_infection(S[h], init, I[h]);
+    }
+  }
+  std::vector<double> lethal(1, config.number("lethal_temp", -12.87));
+  return Simulation(row1 - row0, geometry.ncol, S, I, all_trees, score, lethal, spread_params(config, geometry.xres),
+                    row0, geometry.nrow);
+}
+
+// zone numbers of the rows [row0, row1) (see the parameter zones)
+std::vector<int> zone_rows(const Config& config, const Grid& geometry, int row0, int row1){
+  return counts(raster_rows(config, "zones", geometry, row0, row1, "the zones raster does not match the host rasters"));
+}
+
+int run_config(const std::string& path, int rank, int size){
+  Config config(path);
+  config.check(std::set<std::string>(PARAMETERS, PARAMETERS + sizeof(PARAMETERS) / sizeof(PARAMETERS[0])));
+  Grid geometry = study_area(config);
+  Schedule schedule(schedule_options(config));
+
+  if (size == 1){
+    Simulation sim = load(config, geometry);
+    FileWeather weather(config, geometry);
+    OutputWriter writer(config, geometry, sim.nhosts());
+    std::unique_ptr<pops::ZoneIndex> zones;
+    if (config.has("zones")){
+      std::vector<int> z = zone_rows(config, geometry, 0, geometry.nrow);
+      zones.reset(new pops::ZoneIndex(z, std::max(1, *std::max_element(z.begin(), z.end()))));
+    }
+    LocalObserver observer(writer, zones.get());
+    run_strips(sim, schedule, weather, observer, int(config.number("domains", 1)));
+    std::fprintf(stderr, "the run used %.3g%% of the study area\n",
+                 100.0 * sim.touched_window().cells() / (double(sim.nrow()) * sim.ncol()));
+    return 0;
+  }
+#ifdef POPS_WITH_MPI
+  // strips balanced on the hosts of every row, each process counting an equal
+  // share of the rows of allTrees
+  int slab0 = int(long(geometry.nrow) * rank / size), slab1 = int(long(geometry.nrow) * (rank + 1) / size);
+  std::vector<int> slab;
+  if (config.has("landscape")) slab = LandscapePack(config.required("landscape"), false).all_trees(slab0, slab1);
+  else slab = counts(cli::read_rows(config.required("allTrees"), slab0, slab1));
+  std::vector<double> slab_hosts = row_hosts(slab, slab1 - slab0, geometry.ncol);
+  std::vector<double> mine(geometry.nrow, 0), hosts(geometry.nrow);
+  std::copy(slab_hosts.begin(), slab_hosts.end(), mine.begin() + slab0);
+  MPI_Allreduce(&mine[0], &hosts[0], geometry.nrow, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  std::vector<int> bounds = strip_bounds(hosts, size);
+
+  // only the rows of the strip are read; landings from other strips are
+  // exchanged, so no rows around the strip are needed
+  Simulation strip = load(config, geometry, bounds[rank], bounds[rank + 1], rank == 0);
+  FileWeather weather(config, geometry, bounds[rank], bounds[rank + 1]);
+  std::unique_ptr<OutputWriter> writer;
+  if (rank == 0) writer.reset(new OutputWriter(config, geometry, strip.nhosts()));
+  std::unique_ptr<pops::ZoneIndex> zones;
+  if (config.has("zones")){
+    std::vector<int> z = zone_rows(config, geometry, bounds[rank], bounds[rank + 1]);
+    int nzones = std::max(1, *std::max_element(z.begin(), z.end()));
+    MPI_Allreduce(MPI_IN_PLACE, &nzones, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    zones.reset(new pops::ZoneIndex(z, nzones));
+  }
+  MpiExchange exchange(MPI_COMM_WORLD, bounds);
+  MpiObserver observer(writer.get(), zones.get(), bounds, geometry.ncol, rank);
+  run(strip, schedule, weather, observer, exchange);
+#else
+  (void)rank;
+#endif
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+  int rank = 0, size = 1;
+#ifdef POPS_WITH_MPI
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+  int status = 0;
+  if (argc != 2){
+    if (rank == 0) std::fprintf(stderr, "usage: %s <config file>\n", argv[0]);
+    status = 2;
+  }else{
+    try {
+      status = run_config(argv[1], rank, size);
+    } catch (std::exception& e){
+      std::fprintf(stderr, "pops: %s\n", e.what());
+      status = 1;
+#ifdef POPS_WITH_MPI
+      MPI_Abort(MPI_COMM_WORLD, status);
+#endif
+    }
+  }
+#ifdef POPS_WITH_MPI
+  MPI_Finalize();
+#endif
+  return status;
+}
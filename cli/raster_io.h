@@ -0,0 +1,556 @@
+#ifndef POPS_CLI_RASTER_IO_H
+#define POPS_CLI_RASTER_IO_H
+
+// Raster input and output of the command-line engine.
+//
+// Formats are picked by file extension:
+//  - .asc  ESRI ASCII grid, always available;
+//  - .nc   NetCDF (one layer per time step along the first dimension of the
+//          variable), with POPS_WITH_NETCDF;
+//  - anything else (GeoTIFF, .img, ...) through GDAL, with POPS_WITH_GDAL.
+// Grids are row-major with the northern row first, as in the engine; missing
+// values are NaN. read_window() reads only a window of a layer (GDAL and NetCDF
+// read just those cells; ASCII grids are parsed up to its last row), and
+// read_rows() only some rows of a grid, so a process running a strip of the
+// study area never holds the whole grid. GridWriter writes a grid a block of
+// rows at a time for the same reason.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "window.h"
+
+#ifdef POPS_WITH_GDAL
+#include <cpl_conv.h>
+#include <gdal.h>
+#endif
+#ifdef POPS_WITH_NETCDF
+#include <netcdf.h>
+#endif
+
+namespace pops {
+namespace cli {
+
+struct Grid {
+  int nrow, ncol;
+  double xmin, ymax;    // north-west corner
+  double xres, yres;    // cell size (positive)
+  std::string crs;      // WKT or PROJ string, empty if unknown
+  std::vector<float> values;
+
+  Grid() : nrow(0), ncol(0), xmin(0), ymax(0), xres(1), yres(1) {}
+
+  bool same_shape(const Grid& o) const { return nrow == o.nrow && ncol == o.ncol; }
+
+  // the cells of a window, with its georeference (only the georeference of a
+  // grid without values)
+  Grid crop(const Window& w) const {
+    Grid g = *this;
+    g.nrow = w.nrow();
+    g.ncol = w.ncol();
+    g.xmin = xmin + w.col0 * xres;
+    g.ymax = ymax - w.row0 * yres;
+    if (values.empty()) return g;
+    g.values.resize(std::size_t(g.nrow) * g.ncol);
+    for (int i = 0; i < g.nrow; i++)
+      std::copy(values.begin() + std::size_t(w.row0 + i) * ncol + w.col0,
+                values.begin() + std::size_t(w.row0 + i) * ncol + w.col1, g.values.begin() + std::size_t(i) * g.ncol);
+    return g;
+  }
+};
+
+inline std::string extension(const std::string& path){
+  std::size_t dot = path.find_last_of('.');
+  std::size_t slash = path.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+  std::string ext = path.substr(dot);
+  for (std::size_t k = 0; k < ext.size(); k++) ext[k] = char(std::tolower(ext[k]));
+  return ext;
+}
+
+// ---- ESRI ASCII grid ----
+
+// the header of an ASCII grid (no values); 'key' receives the first value if
+// the header was ended by it
+inline Grid ascii_header(std::istream& in, const std::string& path, double& nodata, std::string& key){
+  Grid g;
+  double xll = 0, yll = 0;
+  nodata = std::numeric_limits<double>::quiet_NaN();
+  bool center = false;
+  key.clear();
+  // header lines: key value, until the first number
+  while (in >> key){
+    if (!key.empty() && (std::isdigit((unsigned char)key[0]) || key[0] == '-' || key[0] == '.')) break;
+    std::string k = key;
+    for (std::size_t i = 0; i < k.size(); i++) k[i] = char(std::tolower(k[i]));
+    double v;
+    if (!(in >> v)) throw std::runtime_error("bad ASCII grid header in " + path);
+    if (k == "ncols") g.ncol = int(v);
+    else if (k == "nrows") g.nrow = int(v);
+    else if (k == "xllcorner") xll = v;
+    else if (k == "yllcorner") yll = v;
+    else if (k == "xllcenter"){ xll = v; center = true; }
+    else if (k == "yllcenter"){ yll = v; center = true; }
+    else if (k == "cellsize") g.xres = g.yres = v;
+    else if (k == "nodata_value") nodata = v;
+    else throw std::runtime_error("unknown ASCII grid header '" + key + "' in " + path);
+    key.clear();
+  }
+  if (g.nrow < 1 || g.ncol < 1) throw std::runtime_error("bad ASCII grid dimensions in " + path);
+  if (center){
+    xll -= g.xres / 2;
+    yll -= g.yres / 2;
+  }
+  g.xmin = xll;
+  g.ymax = yll + g.nrow * g.yres;
+  return g;
+}
+
+// rows [row0, row1) of an ASCII grid (row1 = -1: to the last row),
+// georeferenced as that part of the grid; the rows after row1 are not parsed
+inline Grid read_ascii(const std::string& path, int row0 = 0, int row1 = -1){
+  std::ifstream in(path.c_str());
+  if (!in) throw std::runtime_error("cannot open " + path);
+  double nodata;
+  std::string key;
+  Grid g = ascii_header(in, path, nodata, key);
+  if (row1 < 0) row1 = g.nrow;
+  if (row0 < 0 || row0 > row1 || row1 > g.nrow) throw std::out_of_range(path + ": rows outside of the grid");
+  std::size_t begin = std::size_t(row0) * g.ncol, end = std::size_t(row1) * g.ncol, k = 0;
+  g.values.resize(end - begin);
+  if (!key.empty()){
+    double v = std::strtod(key.c_str(), 0);
+    if (k >= begin && k < end) g.values[k - begin] = v == nodata ? NAN : float(v);
+    k++;
+  }
+  double v;
+  while (k < end && in >> v){
+    if (k >= begin) g.values[k - begin] = v == nodata ? NAN : float(v);
+    k++;
+  }
+  if (k < end) throw std::runtime_error("the ASCII grid " + path + " is truncated");
+  g.ymax -= row0 * g.yres;
+  g.nrow = row1 - row0;
+  return g;
+}
+
+// ---- GDAL ----
+
+#ifdef POPS_WITH_GDAL
+inline Grid read_gdal(const std::string& path, int band){
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!ds) throw std::runtime_error("cannot open " + path);
+  Grid g;
+  try {
+    if (band < 1 || band > GDALGetRasterCount(ds)) throw std::runtime_error(path + " has no band " + std::to_string(band));
+    g.ncol = GDALGetRasterXSize(ds);
+    g.nrow = GDALGetRasterYSize(ds);
+    double t[6];
+    if (GDALGetGeoTransform(ds, t) == CE_None){
+      g.xmin = t[0];
+      g.ymax = t[3];
+      g.xres = t[1];
+      g.yres = -t[5];
+    }
+    const char* wkt = GDALGetProjectionRef(ds);
+    if (wkt) g.crs = wkt;
+    GDALRasterBandH b = GDALGetRasterBand(ds, band);
+    g.values.resize(std::size_t(g.nrow) * g.ncol);
+    if (GDALRasterIO(b, GF_Read, 0, 0, g.ncol, g.nrow, &g.values[0], g.ncol, g.nrow, GDT_Float32, 0, 0) != CE_None)
+      throw std::runtime_error("cannot read " + path);
+    int has_nodata = 0;
+    double nodata = GDALGetRasterNoDataValue(b, &has_nodata);
+    if (has_nodata)
+      for (std::size_t k = 0; k < g.values.size(); k++)
+        if (g.values[k] == float(nodata)) g.values[k] = NAN;
+  } catch (...) {
+    GDALClose(ds);
+    throw;
+  }
+  GDALClose(ds);
+  return g;
+}
+
+// size and georeference of a raster, without its values
+inline Grid read_gdal_header(const std::string& path){
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!ds) throw std::runtime_error("cannot open " + path);
+  Grid g;
+  g.ncol = GDALGetRasterXSize(ds);
+  g.nrow = GDALGetRasterYSize(ds);
+  double t[6];
+  if (GDALGetGeoTransform(ds, t) == CE_None){
+    g.xmin = t[0];
+    g.ymax = t[3];
+    g.xres = t[1];
+    g.yres = -t[5];
+  }
+  const char* wkt = GDALGetProjectionRef(ds);
+  if (wkt) g.crs = wkt;
+  GDALClose(ds);
+  return g;
+}
+
+// the cells of 'w' of a band into 'values' (the rows of the file from
+// row_offset on; the file is nrow x ncol)
+inline void read_gdal_window(const std::string& path, int band, const Window& w, int nrow, int ncol,
+                             std::vector<float>& values, int row_offset = 0){
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(path.c_str(), GA_ReadOnly);
+  if (!ds) throw std::runtime_error("cannot open " + path);
+  try {
+    if (band < 1 || band > GDALGetRasterCount(ds)) throw std::runtime_error(path + " has no band " + std::to_string(band));
+    if (GDALGetRasterXSize(ds) != ncol || GDALGetRasterYSize(ds) != nrow)
+      throw std::runtime_error(path + " does not have the dimensions of the study area");
+    GDALRasterBandH b = GDALGetRasterBand(ds, band);
+    std::vector<float> buf(std::size_t(w.cells()));
+    if (GDALRasterIO(b, GF_Read, w.col0, w.row0, w.ncol(), w.nrow(), &buf[0], w.ncol(), w.nrow(), GDT_Float32, 0, 0) != CE_None)
+      throw std::runtime_error("cannot read " + path);
+    int has_nodata = 0;
+    float nodata = float(GDALGetRasterNoDataValue(b, &has_nodata));
+    for (int i = 0; i < w.nrow(); i++)
+      for (int j = 0; j < w.ncol(); j++){
+        float v = buf[std::size_t(i) * w.ncol() + j];
+        values[std::size_t(w.row0 - row_offset + i) * ncol + w.col0 + j] = has_nodata && v == nodata ? NAN : v;
+      }
+  } catch (...) {
+    GDALClose(ds);
+    throw;
+  }
+  GDALClose(ds);
+}
+#endif
+
+// ---- NetCDF ----
+
+#ifdef POPS_WITH_NETCDF
+inline void nc_check(int status, const std::string& path){
+  if (status != NC_NOERR) throw std::runtime_error(path + ": " + nc_strerror(status));
+}
+
+// the layer variable of an open file: its id, dimension lengths and whether x
+// comes before y
+inline int nc_layer_var(int nc, const std::string& path, const std::string& varid, size_t len[3], bool& x_first){
+  int var = -1, ndims = 0;
+  if (!varid.empty()){
+    nc_check(nc_inq_varid(nc, varid.c_str(), &var), path);
+    nc_check(nc_inq_varndims(nc, var, &ndims), path);
+  }else{
+    int nvars;
+    nc_check(nc_inq_nvars(nc, &nvars), path);
+    for (int v = 0; v < nvars && var < 0; v++){
+      nc_check(nc_inq_varndims(nc, v, &ndims), path);
+      if (ndims == 3) var = v;
+    }
+  }
+  if (var < 0 || ndims != 3) throw std::runtime_error(path + " has no three-dimensional layer variable");
+  int dims[3];
+  nc_check(nc_inq_vardimid(nc, var, dims), path);
+  char name[NC_MAX_NAME + 1];
+  x_first = false;
+  for (int d = 0; d < 3; d++){
+    nc_check(nc_inq_dim(nc, dims[d], name, &len[d]), path);
+    std::string n(name);
+    if (d == 1 && (n == "x" || n == "lon" || n == "longitude")) x_first = true;
+  }
+  return var;
+}
+
+// layer 'band' of a (time, y, x) or (time, x, y) variable; the files written by
+// weather_coeff() are (time, x, y) in C order. varid = "" takes the first
+// three-dimensional variable.
+inline Grid read_netcdf(const std::string& path, int band, const std::string& varid){
+  int nc;
+  nc_check(nc_open(path.c_str(), NC_NOWRITE, &nc), path);
+  Grid g;
+  try {
+    size_t len[3];
+    bool x_first;
+    int var = nc_layer_var(nc, path, varid, len, x_first);
+    if (band < 1 || size_t(band) > len[0]) throw std::runtime_error(path + " has no layer " + std::to_string(band));
+    size_t start[3] = {size_t(band - 1), 0, 0};
+    size_t count[3] = {1, len[1], len[2]};
+    std::vector<float> buf(len[1] * len[2]);
+    nc_check(nc_get_vara_float(nc, var, start, count, &buf[0]), path);
+    float fill;
+    bool has_fill = nc_get_att_float(nc, var, "_FillValue", &fill) == NC_NOERR;
+    g.nrow = int(x_first ? len[2] : len[1]);
+    g.ncol = int(x_first ? len[1] : len[2]);
+    g.values.resize(buf.size());
+    for (int i = 0; i < g.nrow; i++)
+      for (int j = 0; j < g.ncol; j++){
+        float v = x_first ? buf[std::size_t(j) * g.nrow + i] : buf[std::size_t(i) * g.ncol + j];
+        g.values[std::size_t(i) * g.ncol + j] = has_fill && v == fill ? NAN : v;
+      }
+  } catch (...) {
+    nc_close(nc);
+    throw;
+  }
+  nc_close(nc);
+  return g;
+}
+
+// dimensions of the layers of a file (NetCDF files carry no georeference here)
+inline Grid read_netcdf_header(const std::string& path, const std::string& varid){
+  int nc;
+  nc_check(nc_open(path.c_str(), NC_NOWRITE, &nc), path);
+  Grid g;
+  try {
+    size_t len[3];
+    bool x_first;
+    nc_layer_var(nc, path, varid, len, x_first);
+    g.nrow = int(x_first ? len[2] : len[1]);
+    g.ncol = int(x_first ? len[1] : len[2]);
+  } catch (...) {
+    nc_close(nc);
+    throw;
+  }
+  nc_close(nc);
+  return g;
+}
+
+// the cells of 'w' of layer 'band' into 'values' (the rows of the file from
+// row_offset on; the file is nrow x ncol), reading only that hyperslab
+inline void read_netcdf_window(const std::string& path, int band, const std::string& varid, const Window& w,
+                               int nrow, int ncol, std::vector<float>& values, int row_offset = 0){
+  int nc;
+  nc_check(nc_open(path.c_str(), NC_NOWRITE, &nc), path);
+  try {
+    size_t len[3];
+    bool x_first;
+    int var = nc_layer_var(nc, path, varid, len, x_first);
+    if (band < 1 || size_t(band) > len[0]) throw std::runtime_error(path + " has no layer " + std::to_string(band));
+    if (int(x_first ? len[2] : len[1]) != nrow || int(x_first ? len[1] : len[2]) != ncol)
+      throw std::runtime_error(path + " does not have the dimensions of the study area");
+    size_t start[3] = {size_t(band - 1), size_t(x_first ? w.col0 : w.row0), size_t(x_first ? w.row0 : w.col0)};
+    size_t count[3] = {1, size_t(x_first ? w.ncol() : w.nrow()), size_t(x_first ? w.nrow() : w.ncol())};
+    std::vector<float> buf(std::size_t(w.cells()));
+    nc_check(nc_get_vara_float(nc, var, start, count, &buf[0]), path);
+    float fill;
+    bool has_fill = nc_get_att_float(nc, var, "_FillValue", &fill) == NC_NOERR;
+    for (int i = 0; i < w.nrow(); i++)
+      for (int j = 0; j < w.ncol(); j++){
+        float v = x_first ? buf[std::size_t(j) * w.nrow() + i] : buf[std::size_t(i) * w.ncol() + j];
+        values[std::size_t(w.row0 - row_offset + i) * ncol + w.col0 + j] = has_fill && v == fill ? NAN : v;
+      }
+  } catch (...) {
+    nc_close(nc);
+    throw;
+  }
+  nc_close(nc);
+}
+#endif
+
+// ---- dispatch ----
+
+// layer 'band' (from 1) of a raster file; varid names the NetCDF variable
+inline Grid read_grid(const std::string& path, int band = 1, const std::string& varid = ""){
+  std::string ext = extension(path);
+  if (ext == ".asc"){
+    if (band != 1) throw std::runtime_error(path + ": ASCII grids hold a single layer");
+    return read_ascii(path);
+  }
+  if (ext == ".nc"){
+#ifdef POPS_WITH_NETCDF
+    return read_netcdf(path, band, varid);
+#else
+    (void)varid;
+    throw std::runtime_error(path + ": this build has no NetCDF support (POPS_WITH_NETCDF)");
+#endif
+  }
+#ifdef POPS_WITH_GDAL
+  return read_gdal(path, band);
+#else
+  throw std::runtime_error(path + ": this build reads only .asc grids without GDAL (POPS_WITH_GDAL)");
+#endif
+}
+
+// size and georeference of a raster file, without reading its values
+inline Grid read_header(const std::string& path, const std::string& varid = ""){
+  std::string ext = extension(path);
+  if (ext == ".asc"){
+    std::ifstream in(path.c_str());
+    if (!in) throw std::runtime_error("cannot open " + path);
+    double nodata;
+    std::string key;
+    return ascii_header(in, path, nodata, key);
+  }
+  if (ext == ".nc"){
+#ifdef POPS_WITH_NETCDF
+    return read_netcdf_header(path, varid);
+#else
+    (void)varid;
+    throw std::runtime_error(path + ": this build has no NetCDF support (POPS_WITH_NETCDF)");
+#endif
+  }
+#ifdef POPS_WITH_GDAL
+  return read_gdal_header(path);
+#else
+  throw std::runtime_error(path + ": this build reads only .asc grids without GDAL (POPS_WITH_GDAL)");
+#endif
+}
+
+// the cells of 'w' of a layer into 'values', which holds the rows of the
+// grid from row_offset on (the whole nrow x ncol grid by default, the size the
+// file must have); the other cells are left as they are
+inline void read_window(const std::string& path, int band, const std::string& varid, const Window& w,
+                        int nrow, int ncol, std::vector<float>& values, int row_offset = 0){
+  if (w.empty()) return;
+  std::string ext = extension(path);
+  if (ext == ".asc"){
+    if (band != 1) throw std::runtime_error(path + ": ASCII grids hold a single layer");
+    Grid header = read_header(path);
+    if (header.nrow != nrow || header.ncol != ncol)
+      throw std::runtime_error(path + " does not have the dimensions of the study area");
+    Grid g = read_ascii(path, w.row0, w.row1);
+    for (int i = 0; i < g.nrow; i++)
+      std::copy(g.values.begin() + std::size_t(i) * ncol + w.col0, g.values.begin() + std::size_t(i) * ncol + w.col1,
+                values.begin() + std::size_t(w.row0 - row_offset + i) * ncol + w.col0);
+    return;
+  }
+  if (ext == ".nc"){
+#ifdef POPS_WITH_NETCDF
+    return read_netcdf_window(path, band, varid, w, nrow, ncol, values, row_offset);
+#else
+    (void)varid;
+    throw std::runtime_error(path + ": this build has no NetCDF support (POPS_WITH_NETCDF)");
+#endif
+  }
+#ifdef POPS_WITH_GDAL
+  read_gdal_window(path, band, w, nrow, ncol, values, row_offset);
+#else
+  throw std::runtime_error(path + ": this build reads only .asc grids without GDAL (POPS_WITH_GDAL)");
+#endif
+}
+
+// rows [row0, row1) of layer 'band' of a raster, georeferenced as that part
+// of the grid
+inline Grid read_rows(const std::string& path, int row0, int row1, int band = 1, const std::string& varid = ""){
+  if (extension(path) == ".asc"){
+    if (band != 1) throw std::runtime_error(path + ": ASCII grids hold a single layer");
+    return read_ascii(path, row0, row1);
+  }
+  Grid g = read_header(path, varid);
+  if (row0 < 0 || row0 > row1 || row1 > g.nrow) throw std::out_of_range(path + ": rows outside of the grid");
+  g.values.assign(std::size_t(row1 - row0) * g.ncol, NAN);
+  read_window(path, band, varid, Window(row0, row1, 0, g.ncol), g.nrow, g.ncol, g.values, row0);
+  g.ymax -= row0 * g.yres;
+  g.nrow = row1 - row0;
+  return g;
+}
+
+// A grid written a block of rows at a time, northern rows first: an ASCII
+// grid, or a deflate-compressed GeoTIFF through GDAL. 'shape' gives the size
+// and georeference (its values are not used).
+class GridWriter {
+public:
+  GridWriter(const std::string& path, const Grid& shape)
+    : path_(path), nrow_(shape.nrow), ncol_(shape.ncol), written_(0), file_(0){
+#ifdef POPS_WITH_GDAL
+    ds_ = 0;
+#endif
+    if (extension(path) == ".asc"){
+      file_ = std::fopen(path.c_str(), "w");
+      if (!file_) throw std::runtime_error("cannot create " + path);
+      std::fprintf(file_, "ncols %d\nnrows %d\nxllcorner %.10g\nyllcorner %.10g\ncellsize %.10g\nNODATA_value -9999\n",
+                   shape.ncol, shape.nrow, shape.xmin, shape.ymax - shape.nrow * shape.yres, shape.xres);
+      return;
+    }
+#ifdef POPS_WITH_GDAL
+    GDALAllRegister();
+    GDALDriverH driver = GDALGetDriverByName("GTiff");
+    if (!driver) throw std::runtime_error("GDAL has no GeoTIFF driver");
+    char** options = 0;
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    ds_ = GDALCreate(driver, path.c_str(), shape.ncol, shape.nrow, 1, GDT_Float32, options);
+    CSLDestroy(options);
+    if (!ds_) throw std::runtime_error("cannot create " + path);
+    double t[6] = {shape.xmin, shape.xres, 0, shape.ymax, 0, -shape.yres};
+    GDALSetGeoTransform(ds_, t);
+    if (!shape.crs.empty()) GDALSetProjection(ds_, shape.crs.c_str());
+    GDALSetRasterNoDataValue(GDALGetRasterBand(ds_, 1), -9999);
+#else
+    throw std::runtime_error(path + ": this build writes only .asc grids without GDAL (POPS_WITH_GDAL)");
+#endif
+  }
+
+  ~GridWriter(){
+    if (file_) std::fclose(file_);
+#ifdef POPS_WITH_GDAL
+    if (ds_) GDALClose(ds_);
+#endif
+  }
+
+  // the next 'n' rows (n x ncol values, NaN where missing)
+  void rows(const float* values, int n){
+    if (written_ + n > nrow_) throw std::logic_error(path_ + ": more rows written than the grid has");
+    if (file_){
+      for (int i = 0; i < n; i++){
+        for (int j = 0; j < ncol_; j++){
+          float v = values[std::size_t(i) * ncol_ + j];
+          if (std::isnan(v)) std::fputs(j ? " -9999" : "-9999", file_);
+          else std::fprintf(file_, j ? " %.9g" : "%.9g", v);
+        }
+        std::fputc('\n', file_);
+      }
+    }
+#ifdef POPS_WITH_GDAL
+    if (ds_ && n > 0){
+      std::vector<float> out(values, values + std::size_t(n) * ncol_);
+      for (std::size_t k = 0; k < out.size(); k++) if (std::isnan(out[k])) out[k] = -9999;
+      if (GDALRasterIO(GDALGetRasterBand(ds_, 1), GF_Write, 0, written_, ncol_, n, &out[0], ncol_, n, GDT_Float32, 0, 0) != CE_None)
+        throw std::runtime_error("cannot write " + path_);
+    }
+#endif
+    written_ += n;
+  }
+
+  // once every row is written
+  void close(){
+    if (written_ != nrow_) throw std::logic_error(path_ + ": rows missing from the grid");
+    if (file_){
+      int status = std::fclose(file_);
+      file_ = 0;
+      if (status != 0) throw std::runtime_error("cannot write " + path_);
+    }
+#ifdef POPS_WITH_GDAL
+    if (ds_){
+      GDALClose(ds_);
+      ds_ = 0;
+    }
+#endif
+  }
+
+private:
+  GridWriter(const GridWriter&);
+  GridWriter& operator=(const GridWriter&);
+
+  std::string path_;
+  int nrow_, ncol_, written_;
+  std::FILE* file_;
+#ifdef POPS_WITH_GDAL
+  GDALDatasetH ds_;
+#endif
+};
+
+inline void write_grid(const std::string& path, const Grid& g){
+  GridWriter writer(path, g);
+  writer.rows(g.values.empty() ? 0 : &g.values[0], g.nrow);
+  writer.close();
+}
+
+} // namespace cli
+} // namespace pops
+
+#endif
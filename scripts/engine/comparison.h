@@ -0,0 +1,275 @@
+#ifndef POPS_ENGINE_COMPARISON_H
+#define POPS_ENGINE_COMPARISON_H
+
+// Comparison of simulated infections with observations, for calibration.
+//
+// Calibration used to expand every simulated year to a raster and compare it
+// with the observed raster or survey points in R. Here the simulated side is
+// the sparse output of the engine (see sparse_output.h) and the observed side
+// is preprocessed once into an Observation, so a comparison only visits the
+// infected cells of both:
+//  - confusion matrix of infected / not infected units (surveyed cells of an
+//    observed grid, or survey points), with Cohen's kappa and the quantity
+//    and allocation disagreement of Pontius and Millones (2011);
+//  - root mean square error of the infected counts per unit;
+//  - distances (in cells) from every simulated infected cell to the nearest
+//    observed infected unit and back, which still separate parameter sets
+//    when the infections do not overlap at all.
+// A simulated cell is infected with more than 'threshold' infected hosts (all
+// hosts summed), an observed unit with a value greater than zero.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "sparse_output.h"
+
+namespace pops {
+
+// nearest neighbour search among cell centres (2-d tree stored in an array)
+class NearestCells {
+public:
+  NearestCells() {}
+  NearestCells(const std::vector<int>& cells, int ncol){
+    points_.reserve(cells.size());
+    for (std::size_t k = 0; k < cells.size(); k++)
+      points_.push_back(Point(cells[k] / ncol, cells[k] % ncol));
+    build(0, points_.size(), 0);
+  }
+
+  bool empty() const { return points_.empty(); }
+
+  // distance (in cells) from (row, col) to the nearest cell of the set
+  double distance(int row, int col) const {
+    double best = std::numeric_limits<double>::infinity();
+    search(0, points_.size(), 0, row, col, best);
+    return std::sqrt(best);
+  }
+
+private:
+  struct Point {
+    int row, col;
+    Point(int row, int col) : row(row), col(col) {}
+    int at(int axis) const { return axis ? col : row; }
+  };
+
+  struct ByAxis {
+    int axis;
+    explicit ByAxis(int axis) : axis(axis) {}
+    bool operator()(const Point& a, const Point& b) const { return a.at(axis) < b.at(axis); }
+  };
+
+  // median of begin..end-1 along 'axis' at the middle, halves on either side
+  void build(std::size_t begin, std::size_t end, int axis){
+    if (end - begin < 2) return;
+    std::size_t mid = begin + (end - begin) / 2;
+    std::nth_element(points_.begin() + begin, points_.begin() + mid, points_.begin() + end, ByAxis(axis));
+    build(begin, mid, 1 - axis);
+    build(mid + 1, end, 1 - axis);
+  }
+
+  void search(std::size_t begin, std::size_t end, int axis, int row, int col, double& best) const {
+    if (begin >= end) return;
+    std::size_t mid = begin + (end - begin) / 2;
+    const Point& p = points_[mid];
+    double dr = row - p.row, dc = col - p.col;
+    best = std::min(best, dr * dr + dc * dc);
+    double d = axis ? dc : dr;
+    if (d < 0){
+      search(begin, mid, 1 - axis, row, col, best);
+      if (d * d < best) search(mid + 1, end, 1 - axis, row, col, best);
+    }else{
+      search(mid + 1, end, 1 - axis, row, col, best);
+      if (d * d < best) search(begin, mid, 1 - axis, row, col, best);
+    }
+  }
+
+  std::vector<Point> points_;
+};
+
+struct Comparison {
+  long tp, fp, fn, tn;             // simulated / observed: infected / infected, infected / not, not / infected, not / not
+  double kappa;                    // Cohen's kappa (NaN when undefined)
+  double quantity, allocation;     // disagreement, as fractions of the units
+  double rmse;                     // of infected counts per unit
+  double sim_to_obs_mean, sim_to_obs_max;   // distance (cells) from simulated infected cells to the nearest observed infection
+  double obs_to_sim_mean, obs_to_sim_max;   // from observed infected units to the nearest simulated infection
+};
+
+// observed infection: a grid (values per cell, NaN = not surveyed) or survey
+// points (cell and observed count of each point; several points may share a
+// cell, each point is one unit)
+class Observation {
+public:
+  static Observation grid(int nrow, int ncol, const std::vector<float>& values){
+    if (values.size() != std::size_t(nrow) * ncol) throw std::invalid_argument("the observed grid does not have nrow x ncol cells");
+    Observation obs(nrow, ncol, false);
+    obs.surveyed_.assign(values.size(), true);
+    for (std::size_t cell = 0; cell < values.size(); cell++){
+      if (std::isnan(values[cell])){
+        obs.surveyed_[cell] = false;
+        continue;
+      }
+      obs.units_++;
+      if (values[cell] != 0){
+        obs.cells_.push_back(int(cell));
+        obs.values_.push_back(values[cell]);
+      }
+    }
+    obs.index();
+    return obs;
+  }
+
+  // points outside the grid (cell < 0) are not counted
+  static Observation points(int nrow, int ncol, const std::vector<int>& cells, const std::vector<float>& values){
+    if (cells.size() != values.size()) throw std::invalid_argument("every survey point needs an observed value");
+    Observation obs(nrow, ncol, true);
+    std::vector<std::pair<int, float> > pts;
+    for (std::size_t k = 0; k < cells.size(); k++){
+      if (cells[k] < 0 || std::isnan(values[k])) continue;
+      if (std::size_t(cells[k]) >= std::size_t(nrow) * ncol) throw std::invalid_argument("survey point outside the grid");
+      pts.push_back(std::make_pair(cells[k], values[k]));
+    }
+    std::sort(pts.begin(), pts.end());
+    obs.units_ = long(pts.size());
+    for (std::size_t k = 0; k < pts.size(); k++){
+      obs.cells_.push_back(pts[k].first);
+      obs.values_.push_back(pts[k].second);
+    }
+    obs.index();
+    return obs;
+  }
+
+  int nrow() const { return nrow_; }
+  int ncol() const { return ncol_; }
+  bool is_points() const { return points_; }
+  // surveyed cells or points
+  long units() const { return units_; }
+
+  friend Comparison compare(const CellCounts& sim, const Observation& obs, int threshold);
+
+private:
+  Observation(int nrow, int ncol, bool points) : nrow_(nrow), ncol_(ncol), points_(points), units_(0) {}
+
+  bool surveyed(int cell) const { return points_ || surveyed_[cell]; }
+
+  void index(){
+    std::vector<int> infected;
+    for (std::size_t k = 0; k < cells_.size(); k++)
+      if (values_[k] > 0 && (infected.empty() || infected.back() != cells_[k])) infected.push_back(cells_[k]);
+    nearest_ = NearestCells(infected, ncol_);
+    infected_ = infected;
+  }
+
+  int nrow_, ncol_;
+  bool points_;
+  long units_;
+  std::vector<bool> surveyed_;     // grid: cells with an observation
+  std::vector<int> cells_;         // grid: cells with a non-zero value; points: cell of each point (sorted)
+  std::vector<float> values_;
+  std::vector<int> infected_;      // cells observed infected
+  NearestCells nearest_;           // search among infected_
+};
+
+// comparison of the infected hosts 'sim' (summed over hosts, see sum_layers)
+// with an observation of the same grid
+inline Comparison compare(const CellCounts& sim, const Observation& obs, int threshold){
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  Comparison c;
+  c.tp = c.fp = c.fn = c.tn = 0;
+  double se = 0;
+
+  // simulated infected cells that were surveyed (targets of the distances)
+  std::vector<int> sim_cells;
+  for (std::size_t k = 0; k < sim.size(); k++)
+    if (sim[k].second > threshold && obs.surveyed(sim[k].first)) sim_cells.push_back(sim[k].first);
+
+  if (obs.points_){
+    // each point against the simulated count of its cell
+    std::size_t s = 0;
+    for (std::size_t k = 0; k < obs.cells_.size(); k++){
+      int cell = obs.cells_[k];
+      while (s < sim.size() && sim[s].first < cell) s++;
+      int n = s < sim.size() && sim[s].first == cell ? sim[s].second : 0;
+      bool simulated = n > threshold, observed = obs.values_[k] > 0;
+      if (simulated && observed) c.tp++;
+      else if (simulated) c.fp++;
+      else if (observed) c.fn++;
+      else c.tn++;
+      se += (n - double(obs.values_[k])) * (n - double(obs.values_[k]));
+    }
+  }else{
+    // union of the simulated and observed non-zero cells; the other surveyed cells are 0 on both sides
+    std::size_t s = 0, o = 0;
+    while (s < sim.size() || o < obs.cells_.size()){
+      int cell;
+      double n = 0, v = 0;
+      if (o == obs.cells_.size() || (s < sim.size() && sim[s].first < obs.cells_[o])){
+        cell = sim[s].first;
+        n = sim[s++].second;
+      }else if (s == sim.size() || obs.cells_[o] < sim[s].first){
+        cell = obs.cells_[o];
+        v = obs.values_[o++];
+      }else{
+        cell = sim[s].first;
+        n = sim[s++].second;
+        v = obs.values_[o++];
+      }
+      if (!obs.surveyed(cell)) continue;
+      bool simulated = n > threshold, observed = v > 0;
+      if (simulated && observed) c.tp++;
+      else if (simulated) c.fp++;
+      else if (observed) c.fn++;
+      se += (n - v) * (n - v);
+    }
+    c.tn = obs.units_ - c.tp - c.fp - c.fn;
+  }
+
+  double n = double(obs.units_);
+  if (n > 0){
+    double po = (c.tp + c.tn) / n;
+    double pe = (double(c.tp + c.fp) * (c.tp + c.fn) + double(c.fn + c.tn) * (c.fp + c.tn)) / (n * n);
+    c.kappa = pe < 1 ? (po - pe) / (1 - pe) : nan;
+    c.quantity = std::abs(double(c.fp - c.fn)) / n;
+    c.allocation = 2.0 * std::min(c.fp, c.fn) / n;
+    c.rmse = std::sqrt(se / n);
+  }else{
+    c.kappa = c.quantity = c.allocation = c.rmse = nan;
+  }
+
+  // distances in both directions, the queries split among the threads
+  c.sim_to_obs_mean = c.sim_to_obs_max = c.obs_to_sim_mean = c.obs_to_sim_max = nan;
+  if (!sim_cells.empty() && !obs.nearest_.empty()){
+    NearestCells sim_nearest(sim_cells, obs.ncol_);
+    int ncol = obs.ncol_;
+    long ns = long(sim_cells.size()), no = long(obs.infected_.size());
+    double sum = 0, mx = 0;
+    #pragma omp parallel for reduction(+:sum) reduction(max:mx) schedule(static)
+    for (long k = 0; k < ns; k++){
+      double d = obs.nearest_.distance(sim_cells[k] / ncol, sim_cells[k] % ncol);
+      sum += d;
+      mx = std::max(mx, d);
+    }
+    c.sim_to_obs_mean = sum / ns;
+    c.sim_to_obs_max = mx;
+    sum = 0;
+    mx = 0;
+    #pragma omp parallel for reduction(+:sum) reduction(max:mx) schedule(static)
+    for (long k = 0; k < no; k++){
+      double d = sim_nearest.distance(obs.infected_[k] / ncol, obs.infected_[k] % ncol);
+      sum += d;
+      mx = std::max(mx, d);
+    }
+    c.obs_to_sim_mean = sum / no;
+    c.obs_to_sim_max = mx;
+  }
+  return c;
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef POPS_ENGINE_DECOMPOSITION_H
+#define POPS_ENGINE_DECOMPOSITION_H
+
+// Domain decomposition of the study area in row strips.
+//
+// Each part owns a strip of rows and only holds the grids of that strip. On
+// every spread step a part disperses the spores of its own infected cells,
+// batches the landings by destination strip, exchanges them once with the other
+// parts and resolves the landings it received (see spread() in simulation.h).
+// Because the random numbers of a landing are drawn at its source and landings
+// are resolved in global (source cell, spore) order, a decomposed run gives the
+// same result as a single-process run with the same seed.
+//
+// Two transports are provided:
+//  - ThreadExchange: parts are threads of one process (run_strips()), which
+//    spreads the work of a large study area over the cores of a machine;
+//  - MpiExchange (compiled with POPS_WITH_MPI): parts are MPI processes, on one
+//    machine or on a cluster, for study areas too large for a single node.
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "simulation.h"
+
+#ifdef POPS_WITH_MPI
+#include <mpi.h>
+#endif
+
+namespace pops {
+
+// Row bounds of 'parts' strips holding about the same number of hosts (the cost
+// of a strip follows its hosts rather than its area), from the hosts of every
+// row. Every strip has at least one row; the result has parts + 1 entries.
+inline std::vector<int> strip_bounds(const std::vector<double>& row_hosts, int parts){
+  int nrow = int(row_hosts.size());
+  if (parts < 1 || parts > nrow) throw std::invalid_argument("the number of strips must range between 1 and the number of rows");
+  std::vector<double> cumulative(nrow + 1, 0);
+  for (int i = 0; i < nrow; i++)
+    cumulative[i + 1] = cumulative[i] + row_hosts[i] + 1;   // +1 keeps empty rows from being free
+  std::vector<int> bounds(1, 0);
+  for (int p = 1; p < parts; p++){
+    double target = cumulative[nrow] * p / parts;
+    int row = int(std::lower_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin());
+    row = std::max(row, bounds.back() + 1);
+    row = std::min(row, nrow - (parts - p));
+    bounds.push_back(row);
+  }
+  bounds.push_back(nrow);
+  return bounds;
+}
+
+// hosts of every row of a grid (negative counts as 0)
+inline std::vector<double> row_hosts(const std::vector<int>& total_hosts, int nrow, int ncol){
+  std::vector<double> rows(nrow, 0);
+  for (int i = 0; i < nrow; i++)
+    for (int j = 0; j < ncol; j++) rows[i] += std::max(total_hosts[std::size_t(i) * ncol + j], 0);
+  return rows;
+}
+
+inline std::vector<int> strip_bounds(const std::vector<int>& total_hosts, int nrow, int ncol, int parts){
+  return strip_bounds(row_hosts(total_hosts, nrow, ncol), parts);
+}
+
+template <typename T>
+inline std::vector<T> grid_rows(const std::vector<T>& grid, int ncol, int begin, int end){
+  return std::vector<T>(grid.begin() + std::size_t(begin) * ncol, grid.begin() + std::size_t(end) * ncol);
+}
+
+// the strip [begin, end) of a simulation owning the whole study area
+inline Simulation make_strip(const Simulation& sim, int begin, int end){
+  int ncol = sim.ncol();
+  std::vector<std::vector<int> > S, I;
+  for (int h = 0; h < sim.nhosts(); h++){
+    S.push_back(grid_rows(sim.susceptible(h), ncol, begin, end));
+    I.push_back(grid_rows(sim.infected(h), ncol, begin, end));
+  }
+  return Simulation(end - begin, ncol, S, I, grid_rows(sim.total_hosts(), ncol, begin, end),
+                    sim.host_score(), sim.lethal_temp(), sim.params(), begin, sim.global_nrow());
+}
+
+// weather of the study area seen from a strip starting at cell 'offset'
+class StripWeather : public WeatherSource {
+public:
+  StripWeather(WeatherSource& weather, std::size_t offset) : weather_(weather), offset_(offset) {}
+  const float* suitability(int step){
+    const float* w = weather_.suitability(step);
+    return w ? w + offset_ : 0;
+  }
+  const float* crit_temp(int year){
+    const float* c = weather_.crit_temp(year);
+    return c ? c + offset_ : 0;
+  }
+  WindField wind(int step){
+    WindField w = weather_.wind(step);
+    return WindField(w.direction ? w.direction + offset_ : 0, w.kappa ? w.kappa + offset_ : 0);
+  }
+  const float* suitability_in(int step, const Window& window){
+    const float* w = weather_.suitability_in(step, window);
+    return w ? w + offset_ : 0;
+  }
+  const float* crit_temp_in(int year, const Window& window){
+    const float* c = weather_.crit_temp_in(year, window);
+    return c ? c + offset_ : 0;
+  }
+  WindField wind_in(int step, const Window& window){
+    WindField w = weather_.wind_in(step, window);
+    return WindField(w.direction ? w.direction + offset_ : 0, w.kappa ? w.kappa + offset_ : 0);
+  }
+
+private:
+  WeatherSource& weather_;
+  std::size_t offset_;
+};
+
+// thrown by Barrier::wait() in the other strips once a strip failed
+struct BarrierAborted : std::runtime_error {
+  BarrierAborted() : std::runtime_error("another strip of the run failed") {}
+};
+
+// Reusable barrier for the threads of run_strips(). A strip that fails
+// aborts it, so the strips waiting (or arriving later) throw instead of
+// waiting for it forever.
+class Barrier {
+public:
+  explicit Barrier(int count) : count_(count), waiting_(0), generation_(0), aborted_(false) {}
+  void wait(){
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (aborted_) throw BarrierAborted();
+    long generation = generation_;
+    if (++waiting_ == count_){
+      waiting_ = 0;
+      generation_++;
+      cv_.notify_all();
+    }else{
+      cv_.wait(lock, [&]{ return generation != generation_ || aborted_; });
+      if (generation == generation_) throw BarrierAborted();
+    }
+  }
+  void abort(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_ = true;
+    cv_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int count_, waiting_;
+  long generation_;
+  bool aborted_;
+};
+
+// mailboxes shared by the threads of run_strips(): box[from][to]
+struct ThreadMailbox {
+  ThreadMailbox(const std::vector<int>& bounds)
+    : bounds(bounds), parts(int(bounds.size()) - 1), barrier(parts),
+      box(parts, std::vector<std::vector<Landing> >(parts)), values(parts, 0) {}
+  std::vector<int> bounds;
+  int parts;
+  Barrier barrier;
+  std::vector<std::vector<std::vector<Landing> > > box;
+  std::vector<long> values;
+};
+
+class ThreadExchange : public Exchange {
+public:
+  ThreadExchange(ThreadMailbox& mailbox, int rank) : mailbox_(mailbox), rank_(rank) {}
+  int rank() const { return rank_; }
+  int size() const { return mailbox_.parts; }
+  const std::vector<int>& bounds() const { return mailbox_.bounds; }
+
+  void exchange(std::vector<std::vector<Landing> >& outbox, std::vector<Landing>& inbox){
+    for (int p = 0; p < mailbox_.parts; p++) mailbox_.box[rank_][p].swap(outbox[p]);
+    mailbox_.barrier.wait();
+    inbox.clear();
+    for (int p = 0; p < mailbox_.parts; p++){
+      std::vector<Landing>& in = mailbox_.box[p][rank_];
+      inbox.insert(inbox.end(), in.begin(), in.end());
+      in.clear();
+    }
+    mailbox_.barrier.wait();
+  }
+
+  long sum(long value){
+    mailbox_.values[rank_] = value;
+    mailbox_.barrier.wait();
+    long total = 0;
+    for (int p = 0; p < mailbox_.parts; p++) total += mailbox_.values[p];
+    mailbox_.barrier.wait();
+    return total;
+  }
+
+  void barrier(){ mailbox_.barrier.wait(); }
+
+private:
+  ThreadMailbox& mailbox_;
+  int rank_;
+};
+
+// Run a simulation owning the whole study area as 'parts' strips on as many
+// threads. The strips are copied back into 'sim' before each yearly output and
+// at the end, so the observer sees the whole study area at outputs; step_done
+// is reported by the first strip with the state of the last output.
+// observer.cancelled() is called from all threads.
+inline bool run_strips(Simulation& sim, const Schedule& schedule, WeatherSource& weather, StepObserver& observer,
+                       int parts){
+  parts = std::min(parts, sim.nrow());
+  if (parts <= 1) return run(sim, schedule, weather, observer);
+  ThreadMailbox mailbox(strip_bounds(sim.total_hosts(), sim.nrow(), sim.ncol(), parts));
+  std::vector<Simulation> strips;
+  for (int p = 0; p < parts; p++)
+    strips.push_back(make_strip(sim, mailbox.bounds[p], mailbox.bounds[p + 1]));
+
+  // forwards the callbacks of a strip to the observer of the whole run
+  class StripObserver : public StepObserver {
+  public:
+    StripObserver(StepObserver& parent, Simulation& sim, std::vector<Simulation>& strips, ThreadExchange& exchange)
+      : parent_(parent), sim_(sim), strips_(strips), exchange_(exchange) {}
+    bool cancelled(){ return parent_.cancelled(); }
+    void output(const ScheduledStep& e, const Simulation&){
+      exchange_.barrier();
+      if (exchange_.rank() == 0){
+        for (std::size_t p = 0; p < strips_.size(); p++){
+          sim_.assign_rows(strips_[p]);
+          sim_.touch(strips_[p].touched_window());
+        }
+        parent_.output(e, sim_);
+      }
+      exchange_.barrier();
+    }
+    void step_done(const ScheduledStep& e, const Simulation&, int done, int total){
+      if (exchange_.rank() == 0) parent_.step_done(e, sim_, done, total);
+    }
+
+  private:
+    StepObserver& parent_;
+    Simulation& sim_;
+    std::vector<Simulation>& strips_;
+    ThreadExchange& exchange_;
+  };
+
+  std::vector<char> completed(parts, 0);
+  std::vector<std::exception_ptr> errors(parts);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < parts; p++){
+    threads.push_back(std::thread([&, p]{
+      ThreadExchange exchange(mailbox, p);
+      StripObserver strip_observer(observer, sim, strips, exchange);
+      StripWeather strip_weather(weather, std::size_t(mailbox.bounds[p]) * sim.ncol());
+      try {
+        completed[p] = run(strips[p], schedule, strip_weather, strip_observer, exchange);
+      } catch (BarrierAborted&){
+        // another strip failed and reports the error
+      } catch (...){
+        // a strip can fail at any step (e.g. reading the weather of its
+        // window): release the strips waiting for it at the next exchange
+        errors[p] = std::current_exception();
+        mailbox.barrier.abort();
+      }
+    }));
+  }
+  for (int p = 0; p < parts; p++) threads[p].join();
+  for (int p = 0; p < parts; p++)
+    if (errors[p]) std::rethrow_exception(errors[p]);
+  for (int p = 0; p < parts; p++){
+    sim.assign_rows(strips[p]);
+    sim.touch(strips[p].touched_window());
+  }
+  return completed[0] != 0;
+}
+
+#ifdef POPS_WITH_MPI
+// Parts are the processes of an MPI communicator; rank p owns strip p.
+// Landings are plain structs, exchanged as one MPI datatype of their size
+// with one all-to-all of the counts and one all-to-allv of the landings per
+// step. Counts are in landings rather than bytes, so a process can send or
+// receive up to INT_MAX landings in a step.
+class MpiExchange : public Exchange {
+public:
+  MpiExchange(MPI_Comm comm, const std::vector<int>& bounds) : comm_(comm), bounds_(bounds){
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &size_);
+    if (int(bounds_.size()) != size_ + 1) throw std::invalid_argument("strip bounds do not match the number of MPI processes");
+    MPI_Type_contiguous(int(sizeof(Landing)), MPI_BYTE, &landing_type_);
+    MPI_Type_commit(&landing_type_);
+  }
+  ~MpiExchange(){ MPI_Type_free(&landing_type_); }
+  int rank() const { return rank_; }
+  int size() const { return size_; }
+  const std::vector<int>& bounds() const { return bounds_; }
+
+  void exchange(std::vector<std::vector<Landing> >& outbox, std::vector<Landing>& inbox){
+    std::vector<int> send_counts(size_), recv_counts(size_), send_displs(size_), recv_displs(size_);
+    std::vector<Landing> send;
+    for (int p = 0; p < size_; p++){
+      if (send.size() + outbox[p].size() > std::size_t(INT_MAX))
+        throw std::overflow_error("more than INT_MAX landings to send in one step");
+      send_displs[p] = int(send.size());
+      send_counts[p] = int(outbox[p].size());
+      send.insert(send.end(), outbox[p].begin(), outbox[p].end());
+    }
+    MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT, comm_);
+    long total = 0;
+    for (int p = 0; p < size_; p++){
+      if (total + recv_counts[p] > long(INT_MAX)) throw std::overflow_error("more than INT_MAX landings to receive in one step");
+      recv_displs[p] = int(total);
+      total += recv_counts[p];
+    }
+    inbox.resize(total);
+    MPI_Alltoallv(send.empty() ? 0 : &send[0], &send_counts[0], &send_displs[0], landing_type_,
+                  inbox.empty() ? 0 : &inbox[0], &recv_counts[0], &recv_displs[0], landing_type_, comm_);
+  }
+
+  long sum(long value){
+    long total = 0;
+    MPI_Allreduce(&value, &total, 1, MPI_LONG, MPI_SUM, comm_);
+    return total;
+  }
+
+private:
+  MpiExchange(const MpiExchange&);
+  MpiExchange& operator=(const MpiExchange&);
+
+  MPI_Comm comm_;
+  std::vector<int> bounds_;
+  int rank_, size_;
+  MPI_Datatype landing_type_;
+};
+#endif
+
+} // namespace pops
+
+#endif
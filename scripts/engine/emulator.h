@@ -0,0 +1,336 @@
+#ifndef POPS_ENGINE_EMULATOR_H
+#define POPS_ENGINE_EMULATOR_H
+
+// Gaussian-process emulator of a calibration metric.
+//
+// Calibration used to run every point of a grid over scale1, sporeRate, ...
+// with a list of seeds each, so its cost grew with the product of the grid
+// sizes. An Emulator is a Gaussian process fit to the metric of the points run
+// so far (lower is better), over the parameter box scaled to [0, 1] per
+// parameter: constant mean, squared exponential covariance with one length
+// scale per parameter and a nugget for the noise of the replicates. The
+// length scales and the nugget maximize the marginal likelihood (the variance
+// is profiled out), found by a pattern search on a log scale that starts from
+// the previous fit. The next points to run are those of largest expected
+// improvement over the best posterior mean of the points run so far, searched
+// among random candidates (uniform in the box, and around the current best).
+// A batch is proposed one point at a time, each one added as if its predicted
+// mean had been observed (kriging believer), so the points of a batch spread
+// out and can run at the same time.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "rng.h"
+
+namespace pops {
+
+struct EmulatorPrediction {
+  double mean, sd;   // posterior mean and standard deviation of the metric (without the noise of the replicates)
+};
+
+// n points of a Latin hypercube in [0, 1]^dims (every parameter has one point
+// in each of n equal slices), point i at [i * dims, (i + 1) * dims)
+inline std::vector<double> latin_hypercube(int n, int dims, uint64_t seed){
+  std::vector<double> x(std::size_t(n) * dims);
+  std::vector<int> slice(n);
+  Rng rng(seed, 0x4C415449ULL);
+  for (int d = 0; d < dims; d++){
+    for (int i = 0; i < n; i++) slice[i] = i;
+    for (int i = n - 1; i > 0; i--) std::swap(slice[i], slice[int(rng.uniform() * (i + 1))]);
+    for (int i = 0; i < n; i++) x[std::size_t(i) * dims + d] = (slice[i] + rng.uniform()) / n;
+  }
+  return x;
+}
+
+class Emulator {
+public:
+  explicit Emulator(int dims)
+    : dims_(dims), log_scale_(dims, std::log(0.25)), log_nugget_(std::log(0.01)), mean_(0), sd_(1), sigma2_(1),
+      nll_(NAN), incumbent_(0), incumbent_mean_(NAN), fitted_(false){
+    if (dims < 1) throw std::invalid_argument("an emulator needs at least one parameter");
+  }
+
+  int dims() const { return dims_; }
+  std::size_t size() const { return y_.size(); }
+  bool fitted() const { return fitted_; }
+
+  // point i (coordinates in [0, 1]) and its metric
+  const double* x(std::size_t i) const { return &x_[i * dims_]; }
+  double y(std::size_t i) const { return y_[i]; }
+
+  // a point run and its metric (mean of its replicates); fit() again before predicting
+  void add(const double* x, double y){
+    for (int d = 0; d < dims_; d++)
+      if (!(x[d] >= 0 && x[d] <= 1)) throw std::invalid_argument("emulator points must lie in [0, 1]");
+    if (!std::isfinite(y)) throw std::invalid_argument("the metric of an emulator point must be finite");
+    x_.insert(x_.end(), x, x + dims_);
+    y_.push_back(y);
+    fitted_ = false;
+  }
+
+  // length scales and nugget of maximum likelihood
+  void fit(){
+    if (size() < 2) throw std::runtime_error("an emulator needs at least two points");
+    standardize();
+    std::vector<double> theta(log_scale_);
+    theta.push_back(log_nugget_);
+    double best = neg_log_likelihood(theta);
+    if (!std::isfinite(best)){
+      // the previous fit does not factorize with the new points: start over
+      std::fill(theta.begin(), theta.end() - 1, std::log(0.25));
+      theta.back() = std::log(0.01);
+      best = neg_log_likelihood(theta);
+    }
+    for (double step = 1; step > 0.02; step /= 2){
+      for (int pass = 0; pass < 50; pass++){
+        bool improved = false;
+        for (std::size_t k = 0; k < theta.size(); k++)
+          for (int sign = -1; sign <= 1; sign += 2){
+            std::vector<double> t(theta);
+            t[k] = std::min(upper(k), std::max(lower(k), t[k] + sign * step));
+            if (t[k] == theta[k]) continue;
+            double v = neg_log_likelihood(t);
+            if (v < best - 1e-9){
+              best = v;
+              theta.swap(t);
+              improved = true;
+            }
+          }
+        if (!improved) break;
+      }
+    }
+    if (!std::isfinite(best)) throw std::runtime_error("the emulator covariance is not positive definite");
+    log_scale_.assign(theta.begin(), theta.end() - 1);
+    log_nugget_ = theta.back();
+    nll_ = best;
+    factorize();
+  }
+
+  // length scale of parameter d (in units of its range), nugget (as a fraction of the variance of the metric) and the
+  // negative log likelihood of the last fit
+  double length_scale(int d) const { return std::exp(log_scale_[d]); }
+  double nugget() const { return std::exp(log_nugget_); }
+  double neg_log_likelihood() const { return nll_; }
+  // standard deviation of the noise of the replicates, in units of the metric
+  double noise_sd() const { return sd_ * std::sqrt(sigma2_ * nugget()); }
+
+  EmulatorPrediction predict(const double* x) const {
+    check_fitted();
+    std::size_t n = size();
+    std::vector<double> k(n);
+    double mean = 0;
+    for (std::size_t i = 0; i < n; i++){
+      k[i] = correlation(x, this->x(i));
+      mean += k[i] * alpha_[i];
+    }
+    // v = L^-1 k, so that k' K^-1 k = v'v
+    double vv = 0;
+    for (std::size_t i = 0; i < n; i++){
+      double s = k[i];
+      for (std::size_t j = 0; j < i; j++) s -= chol_[i * n + j] * k[j];
+      k[i] = s / chol_[i * n + i];
+      vv += k[i] * k[i];
+    }
+    EmulatorPrediction p;
+    p.mean = mean_ + sd_ * mean;
+    p.sd = sd_ * std::sqrt(std::max(0.0, sigma2_ * (1 - vv)));
+    return p;
+  }
+
+  // best posterior mean among the points run so far, and the point that has it
+  double incumbent() const { check_fitted(); return incumbent_mean_; }
+  const double* incumbent_point() const { check_fitted(); return x(incumbent_); }
+
+  // expected decrease of the metric below the incumbent at x
+  double expected_improvement(const double* x) const {
+    EmulatorPrediction p = predict(x);
+    double gain = incumbent_mean_ - p.mean;
+    if (p.sd <= 0) return std::max(0.0, gain);
+    double z = gain / p.sd;
+    return gain * 0.5 * std::erfc(-z / std::sqrt(2.0)) + p.sd * std::exp(-0.5 * z * z) * 0.3989422804014327;
+  }
+
+  // next 'batch' points to run (point b at [b * dims, (b + 1) * dims)), searched among 'candidates' random points,
+  // with the expected improvement of each when it was picked
+  std::vector<double> propose(int batch, int candidates, uint64_t seed, std::vector<double>& improvement) const {
+    check_fitted();
+    Emulator believer(*this);
+    std::vector<double> out;
+    improvement.clear();
+    std::vector<double> c = draw_candidates(candidates, seed);
+    for (int b = 0; b < batch; b++){
+      double best = -1;
+      std::size_t pick = 0;
+      for (std::size_t i = 0; i < c.size() / dims_; i++){
+        double ei = believer.expected_improvement(&c[i * dims_]);
+        if (ei > best){
+          best = ei;
+          pick = i;
+        }
+      }
+      const double* x = &c[pick * dims_];
+      out.insert(out.end(), x, x + dims_);
+      improvement.push_back(best);
+      if (b + 1 < batch){
+        believer.add(x, believer.predict(x).mean);
+        believer.factorize();
+      }
+    }
+    return out;
+  }
+
+  // point of lowest posterior mean among the points run so far and 'candidates' random points
+  std::vector<double> optimum(int candidates, uint64_t seed, EmulatorPrediction& at) const {
+    check_fitted();
+    std::vector<double> c = draw_candidates(candidates, seed);
+    c.insert(c.end(), x_.begin(), x_.end());
+    std::size_t pick = 0;
+    at.mean = std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < c.size() / dims_; i++){
+      EmulatorPrediction p = predict(&c[i * dims_]);
+      if (p.mean < at.mean){
+        at = p;
+        pick = i;
+      }
+    }
+    return std::vector<double>(c.begin() + pick * dims_, c.begin() + (pick + 1) * dims_);
+  }
+
+private:
+  double lower(std::size_t k) const { return k < std::size_t(dims_) ? std::log(0.02) : std::log(1e-6); }
+  double upper(std::size_t k) const { return k < std::size_t(dims_) ? std::log(5.0) : 0.0; }
+
+  void check_fitted() const {
+    if (!fitted_) throw std::runtime_error("the emulator must be fit after adding points");
+  }
+
+  void standardize(){
+    double n = double(size()), sum = 0, sq = 0;
+    for (std::size_t i = 0; i < size(); i++) sum += y_[i];
+    mean_ = sum / n;
+    for (std::size_t i = 0; i < size(); i++) sq += (y_[i] - mean_) * (y_[i] - mean_);
+    sd_ = std::sqrt(sq / n);
+    if (!(sd_ > 0)) sd_ = 1;
+  }
+
+  double correlation(const double* a, const double* b, const double* inv_scale) const {
+    double r = 0;
+    for (int d = 0; d < dims_; d++){
+      double u = (a[d] - b[d]) * inv_scale[d];
+      r += u * u;
+    }
+    return std::exp(-0.5 * r);
+  }
+  double correlation(const double* a, const double* b) const { return correlation(a, b, &inv_scale_[0]); }
+
+  // lower Cholesky factor of the covariance of the points with length scales exp(theta[0..dims)) and nugget
+  // exp(theta[dims]), in place; false if not positive definite
+  bool cholesky(const std::vector<double>& theta, std::vector<double>& l) const {
+    std::size_t n = size();
+    std::vector<double> inv(dims_);
+    for (int d = 0; d < dims_; d++) inv[d] = std::exp(-theta[d]);
+    double nugget = std::exp(theta[dims_]) + 1e-10;
+    l.assign(n * n, 0);
+    for (std::size_t i = 0; i < n; i++){
+      for (std::size_t j = 0; j <= i; j++){
+        double s = i == j ? 1 + nugget : correlation(x(i), x(j), &inv[0]);
+        for (std::size_t k = 0; k < j; k++) s -= l[i * n + k] * l[j * n + k];
+        if (i == j){
+          if (!(s > 0)) return false;
+          l[i * n + i] = std::sqrt(s);
+        }else{
+          l[i * n + j] = s / l[j * n + j];
+        }
+      }
+    }
+    return true;
+  }
+
+  // K^-1 z from the Cholesky factor
+  std::vector<double> solve(const std::vector<double>& l, std::vector<double> z) const {
+    std::size_t n = size();
+    for (std::size_t i = 0; i < n; i++){
+      for (std::size_t j = 0; j < i; j++) z[i] -= l[i * n + j] * z[j];
+      z[i] /= l[i * n + i];
+    }
+    for (std::size_t i = n; i-- > 0;){
+      for (std::size_t j = i + 1; j < n; j++) z[i] -= l[j * n + i] * z[j];
+      z[i] /= l[i * n + i];
+    }
+    return z;
+  }
+
+  std::vector<double> standardized() const {
+    std::vector<double> z(size());
+    for (std::size_t i = 0; i < size(); i++) z[i] = (y_[i] - mean_) / sd_;
+    return z;
+  }
+
+  double neg_log_likelihood(const std::vector<double>& theta) const {
+    std::vector<double> l;
+    if (!cholesky(theta, l)) return std::numeric_limits<double>::infinity();
+    std::vector<double> z = standardized(), a = solve(l, z);
+    std::size_t n = size();
+    double quad = 0, logdet = 0;
+    for (std::size_t i = 0; i < n; i++){
+      quad += z[i] * a[i];
+      logdet += std::log(l[i * n + i]);
+    }
+    return 0.5 * n * std::log(std::max(quad / n, 1e-300)) + logdet;
+  }
+
+  // factorization for the current hyperparameters, and the incumbent
+  void factorize(){
+    std::vector<double> theta(log_scale_);
+    theta.push_back(log_nugget_);
+    if (!cholesky(theta, chol_)) throw std::runtime_error("the emulator covariance is not positive definite");
+    inv_scale_.resize(dims_);
+    for (int d = 0; d < dims_; d++) inv_scale_[d] = std::exp(-log_scale_[d]);
+    std::vector<double> z = standardized();
+    alpha_ = solve(chol_, z);
+    double quad = 0;
+    for (std::size_t i = 0; i < size(); i++) quad += z[i] * alpha_[i];
+    sigma2_ = std::max(quad / size(), 1e-300);
+    fitted_ = true;
+    incumbent_mean_ = std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < size(); i++){
+      double m = predict(x(i)).mean;
+      if (m < incumbent_mean_){
+        incumbent_mean_ = m;
+        incumbent_ = i;
+      }
+    }
+  }
+
+  // half uniform in the box, half around the incumbent (normal, sd 0.05 of the range)
+  std::vector<double> draw_candidates(int candidates, uint64_t seed) const {
+    Rng rng(seed, 0x43414E44ULL, size());
+    std::vector<double> c(std::size_t(std::max(candidates, 1)) * dims_);
+    const double* centre = x(incumbent_);
+    for (std::size_t i = 0; i < c.size() / dims_; i++)
+      for (int d = 0; d < dims_; d++){
+        double v = i % 2 ? centre[d] + 0.05 * rng.normal() : rng.uniform();
+        c[i * dims_ + d] = std::min(1.0, std::max(0.0, v));
+      }
+    return c;
+  }
+
+  int dims_;
+  std::vector<double> x_, y_;
+  std::vector<double> log_scale_;
+  double log_nugget_;
+  double mean_, sd_, sigma2_, nll_;
+  std::vector<double> chol_, alpha_, inv_scale_;
+  std::size_t incumbent_;
+  double incumbent_mean_;
+  bool fitted_;
+};
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef POPS_ENGINE_ENSEMBLE_H
+#define POPS_ENGINE_ENSEMBLE_H
+
+// Online aggregation of the replicates of an ensemble.
+//
+// Risk maps used to be built by keeping the yearly rasters of every replicate
+// and stacking them at the end, so memory grew with the number of replicates.
+// An Ensemble takes the yearly outputs of one finished replicate at a time
+// and only keeps running statistics per output year:
+//  - per cell: replicates in which the cell was infected (more than
+//    'threshold' infected hosts, all hosts summed), and the sum and sum of
+//    squares of its infected hosts, giving the probability of infection and
+//    the mean and variance of infected hosts;
+//  - per year: mean and variance (Welford) and quantiles (P2 estimator, see
+//    P2Quantile) of the infected area and of the infected hosts.
+// The per-cell sums are integers held exactly in doubles, so the result does
+// not depend on the order the replicates are added in. Only the cells a
+// replicate ever infected get statistics (a slot of nyears values), so an
+// ensemble over a large study area costs one index grid plus the cells the
+// outbreak reached.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "job.h"
+
+namespace pops {
+
+// Streaming estimate of the p-quantile of a series (P-square algorithm, Jain
+// and Chlamtac 1985): five markers whose heights are adjusted with parabolic
+// interpolation as values arrive. Exact up to five values.
+class P2Quantile {
+public:
+  explicit P2Quantile(double p = 0.5) : p_(p), n_(0){
+    if (!(p >= 0 && p <= 1)) throw std::invalid_argument("quantile probabilities must be between 0 and 1");
+    double d[5] = {0, p / 2, p, (1 + p) / 2, 1};
+    for (int i = 0; i < 5; i++){
+      dn_[i] = d[i];
+      np_[i] = 1 + 4 * d[i];
+      pos_[i] = i + 1;
+      q_[i] = 0;
+    }
+  }
+
+  double probability() const { return p_; }
+  long count() const { return n_; }
+
+  void add(double x){
+    if (n_ < 5){
+      q_[n_++] = x;
+      std::sort(q_, q_ + n_);
+      return;
+    }
+    n_++;
+    int k;
+    if (x < q_[0]){
+      q_[0] = x;
+      k = 0;
+    }else if (x >= q_[4]){
+      q_[4] = x;
+      k = 3;
+    }else{
+      k = 0;
+      while (x >= q_[k + 1]) k++;
+    }
+    for (int i = k + 1; i < 5; i++) pos_[i]++;
+    for (int i = 0; i < 5; i++) np_[i] += dn_[i];
+    for (int i = 1; i < 4; i++){
+      double d = np_[i] - pos_[i];
+      if ((d >= 1 && pos_[i + 1] - pos_[i] > 1) || (d <= -1 && pos_[i - 1] - pos_[i] < -1)){
+        int s = d > 0 ? 1 : -1;
+        double h = parabolic(i, s);
+        if (!(q_[i - 1] < h && h < q_[i + 1])) h = q_[i] + s * (q_[i + s] - q_[i]) / (pos_[i + s] - pos_[i]);
+        q_[i] = h;
+        pos_[i] += s;
+      }
+    }
+  }
+
+  // current estimate (NaN before the first value)
+  double value() const {
+    if (n_ == 0) return std::numeric_limits<double>::quiet_NaN();
+    if (n_ <= 5){
+      // same interpolation as R's quantile(type = 7)
+      double h = (n_ - 1) * p_;
+      int lo = int(std::floor(h));
+      int hi = std::min(lo + 1, int(n_) - 1);
+      return q_[lo] + (h - lo) * (q_[hi] - q_[lo]);
+    }
+    return q_[2];
+  }
+
+private:
+  double parabolic(int i, int s) const {
+    return q_[i] + s / (pos_[i + 1] - pos_[i - 1]) *
+      ((pos_[i] - pos_[i - 1] + s) * (q_[i + 1] - q_[i]) / (pos_[i + 1] - pos_[i]) +
+       (pos_[i + 1] - pos_[i] - s) * (q_[i] - q_[i - 1]) / (pos_[i] - pos_[i - 1]));
+  }
+
+  double p_;
+  long n_;
+  double q_[5];      // marker heights
+  double pos_[5];    // marker positions
+  double np_[5];     // desired positions
+  double dn_[5];     // increments of the desired positions
+};
+
+// running mean and variance (Welford)
+class RunningStats {
+public:
+  RunningStats() : n_(0), mean_(0), m2_(0) {}
+
+  void add(double x){
+    n_++;
+    double d = x - mean_;
+    mean_ += d / n_;
+    m2_ += d * (x - mean_);
+  }
+
+  long count() const { return n_; }
+  double mean() const { return n_ > 0 ? mean_ : std::numeric_limits<double>::quiet_NaN(); }
+  // sample variance (NaN with fewer than two values)
+  double variance() const { return n_ > 1 ? m2_ / (n_ - 1) : std::numeric_limits<double>::quiet_NaN(); }
+
+private:
+  long n_;
+  double mean_, m2_;
+};
+
+// statistics of one output year over the replicates
+struct EnsembleTotals {
+  RunningStats area, hosts;                    // infected cells, infected hosts
+  std::vector<P2Quantile> area_q, hosts_q;     // one per probability of the ensemble
+};
+
+class Ensemble {
+public:
+  // ensemble over grids of 'ncell' cells with outputs in 'years'; a cell
+  // counts as infected with more than 'threshold' infected hosts
+  Ensemble(std::size_t ncell, const std::vector<int>& years, const std::vector<double>& probs, int threshold = 0)
+    : ncell_(ncell), years_(years), threshold_(threshold), replicates_(0), slot_(ncell, -1),
+      hosts_(ncell, 0), totals_(years.size()){
+    if (years.empty()) throw std::invalid_argument("the ensemble needs at least one output year");
+    if (threshold < 0) throw std::invalid_argument("the infection threshold must not be negative");
+    for (std::size_t k = 0; k < totals_.size(); k++)
+      for (std::size_t i = 0; i < probs.size(); i++){
+        totals_[k].area_q.push_back(P2Quantile(probs[i]));
+        totals_[k].hosts_q.push_back(P2Quantile(probs[i]));
+      }
+  }
+
+  std::size_t ncell() const { return ncell_; }
+  const std::vector<int>& years() const { return years_; }
+  int threshold() const { return threshold_; }
+  long replicates() const { return replicates_; }
+  // cells with infected hosts at an output year in at least one replicate
+  std::size_t cells() const { return cell_.size(); }
+  const EnsembleTotals& totals(std::size_t k) const { return totals_.at(k); }
+
+  // add the yearly outputs of one replicate (every year of the ensemble,
+  // in any order; outputs of other years are ignored)
+  void add(const std::vector<const YearlyOutput*>& outputs){
+    std::vector<const YearlyOutput*> by_year(years_.size(), 0);
+    for (std::size_t o = 0; o < outputs.size(); o++){
+      std::vector<int>::const_iterator it = std::find(years_.begin(), years_.end(), outputs[o]->year);
+      if (it == years_.end()) continue;
+      for (std::size_t h = 0; h < outputs[o]->I.size(); h++)
+        if (outputs[o]->I[h].ncell() != ncell_) throw std::invalid_argument("the replicate does not have the grid of the ensemble");
+      by_year[it - years_.begin()] = outputs[o];
+    }
+    for (std::size_t k = 0; k < years_.size(); k++)
+      if (!by_year[k]) throw std::invalid_argument("the replicate has no output for year " + std::to_string(years_[k]));
+
+    for (std::size_t k = 0; k < years_.size(); k++) add_year(k, *by_year[k]);
+    replicates_++;
+  }
+
+  // f(cell, probability, mean, variance) at output year k for every cell of
+  // cells() (the others are 0 everywhere)
+  template <typename F>
+  void for_each(std::size_t k, F f) const {
+    if (k >= years_.size()) throw std::out_of_range("the ensemble has no such year");
+    double n = double(replicates_);
+    for (std::size_t s = 0; s < cell_.size(); s++){
+      std::size_t at = s * years_.size() + k;
+      double mean = sum_[at] / n;
+      double variance = replicates_ > 1 ? (sumsq_[at] - sum_[at] * mean) / (n - 1) : std::numeric_limits<double>::quiet_NaN();
+      f(cell_[s], runs_[at] / n, mean, variance);
+    }
+  }
+
+private:
+  void add_year(std::size_t k, const YearlyOutput& out){
+    // infected hosts of the cells of this year, summed over the hosts
+    touched_.clear();
+    for (std::size_t h = 0; h < out.I.size(); h++)
+      out.I[h].for_each([this](long cell, int value){
+        if (hosts_[cell] == 0) touched_.push_back(int(cell));
+        hosts_[cell] += value;
+      });
+    long area = 0, hosts = 0;
+    for (std::size_t t = 0; t < touched_.size(); t++){
+      int cell = touched_[t];
+      int n = hosts_[cell];
+      hosts_[cell] = 0;
+      hosts += n;
+      if (n > threshold_) area++;
+      std::size_t at = slot(cell) * years_.size() + k;
+      if (n > threshold_) runs_[at]++;
+      sum_[at] += n;
+      sumsq_[at] += double(n) * n;
+    }
+    EnsembleTotals& totals = totals_[k];
+    totals.area.add(double(area));
+    totals.hosts.add(double(hosts));
+    for (std::size_t i = 0; i < totals.area_q.size(); i++){
+      totals.area_q[i].add(double(area));
+      totals.hosts_q[i].add(double(hosts));
+    }
+  }
+
+  // statistics of a cell, given a slot the first time it is infected
+  std::size_t slot(int cell){
+    if (slot_[cell] < 0){
+      slot_[cell] = int(cell_.size());
+      cell_.push_back(cell);
+      runs_.resize(runs_.size() + years_.size(), 0);
+      sum_.resize(sum_.size() + years_.size(), 0);
+      sumsq_.resize(sumsq_.size() + years_.size(), 0);
+    }
+    return std::size_t(slot_[cell]);
+  }
+
+  std::size_t ncell_;
+  std::vector<int> years_;
+  int threshold_;
+  long replicates_;
+  std::vector<int> slot_;             // slot of each cell, -1 if never infected
+  std::vector<int> cell_;             // cell of each slot
+  std::vector<int> runs_;             // per slot and year: replicates with the cell infected
+  std::vector<double> sum_, sumsq_;   // per slot and year: infected hosts and their squares
+  std::vector<int> hosts_;            // scratch: infected hosts of the year being added
+  std::vector<int> touched_;          // scratch: cells with hosts_ > 0
+  std::vector<EnsembleTotals> totals_;
+};
+
+} // namespace pops
+
+#endif
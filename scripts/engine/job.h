@@ -0,0 +1,318 @@
+#ifndef POPS_ENGINE_JOB_H
+#define POPS_ENGINE_JOB_H
+
+// Asynchronous simulation jobs.
+//
+// A job owns a Simulation and runs it on a worker thread so the caller (the
+// Shiny session) stays responsive. The caller polls the progress snapshot,
+// can cancel the run between two steps and collects downsampled frames of the
+// infected grid from a bounded ring buffer while the run is going on. The
+// yearly outputs are recorded for the caller once the job is done.
+//
+// Weather inputs are handed over in memory before the start: the worker thread
+// must not call back into R to read rasters or NetCDF files.
+//
+// A finished job can be forked (fork()): each child job continues from the
+// final state of its parent over the rest of the schedule, with its own random
+// stream and optionally its own weather. The parent typically runs the shared
+// historical period up to a fork date and the children the diverging futures.
+//
+// The infected grids of the yearly outputs are kept compressed (see
+// sparse_output.h) and only expanded by the caller for the years it shows.
+// With zone indices (see zones.h) every yearly output also sums the infection
+// per zone.
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decomposition.h"
+#include "schedule.h"
+#include "simulation.h"
+#include "sparse_output.h"
+#include "zones.h"
+
+namespace pops {
+
+// weather grids preloaded in memory, keyed by step and by year
+class MemoryWeather : public WeatherSource {
+public:
+  void add_suitability(int step, const std::vector<float>& grid){ suitability_[step] = grid; }
+  void add_crit_temp(int year, const std::vector<float>& grid){ crit_temp_[year] = grid; }
+  // wind field of a step; kappa may be empty (kappa of the kernel everywhere)
+  void add_wind(int step, const std::vector<float>& direction, const std::vector<float>& kappa){
+    wind_direction_[step] = direction;
+    if (!kappa.empty()) wind_kappa_[step] = kappa;
+  }
+
+  const float* suitability(int step){
+    std::map<int, std::vector<float> >::const_iterator it = suitability_.find(step);
+    return it == suitability_.end() ? 0 : &it->second[0];
+  }
+  const float* crit_temp(int year){
+    std::map<int, std::vector<float> >::const_iterator it = crit_temp_.find(year);
+    return it == crit_temp_.end() ? 0 : &it->second[0];
+  }
+  WindField wind(int step){
+    std::map<int, std::vector<float> >::const_iterator d = wind_direction_.find(step);
+    if (d == wind_direction_.end()) return WindField();
+    std::map<int, std::vector<float> >::const_iterator k = wind_kappa_.find(step);
+    return WindField(&d->second[0], k == wind_kappa_.end() ? 0 : &k->second[0]);
+  }
+
+private:
+  std::map<int, std::vector<float> > suitability_;
+  std::map<int, std::vector<float> > crit_temp_;
+  std::map<int, std::vector<float> > wind_direction_, wind_kappa_;
+};
+
+struct JobOptions {
+  int frame_every;      // take a frame every n scheduled steps (0 = only at outputs)
+  int frame_max_dim;    // frames are block-aggregated down to at most this many rows/cols
+  int frame_capacity;   // frames kept in the ring buffer
+  int domains;          // row strips run on as many threads (see decomposition.h)
+  std::vector<std::shared_ptr<const ZoneIndex> > zones;   // zonal summaries at every yearly output
+
+  JobOptions() : frame_every(1), frame_max_dim(200), frame_capacity(32), domains(1) {}
+};
+
+// downsampled snapshot of the infected hosts (all hosts summed)
+struct Frame {
+  long seq;
+  int step;
+  Date date;
+  int nrow, ncol;       // frame dimensions
+  int factor;           // grid cells aggregated per frame row/col
+  std::vector<int> values;
+};
+
+// block-sum the infected hosts into a frame of at most max_dim rows/cols;
+// only infected cells are visited
+inline void downsample(const Simulation& sim, int max_dim, Frame& frame){
+  int dim = std::max(sim.nrow(), sim.ncol());
+  int factor = max_dim > 0 ? (dim + max_dim - 1) / max_dim : 1;
+  if (factor < 1) factor = 1;
+  frame.factor = factor;
+  frame.nrow = (sim.nrow() + factor - 1) / factor;
+  frame.ncol = (sim.ncol() + factor - 1) / factor;
+  frame.values.assign(std::size_t(frame.nrow) * frame.ncol, 0);
+  const std::vector<int>& cells = sim.infected_cells();
+  for (std::size_t k = 0; k < cells.size(); k++){
+    int cell = cells[k];
+    int r = cell / sim.ncol() / factor;
+    int c = cell % sim.ncol() / factor;
+    int n = 0;
+    for (int h = 0; h < sim.nhosts(); h++) n += sim.infected(h)[cell];
+    frame.values[std::size_t(r) * frame.ncol + c] += n;
+  }
+}
+
+// fixed capacity ring of frames: the oldest frames are dropped when a slow
+// reader falls behind
+class FrameBuffer {
+public:
+  explicit FrameBuffer(int capacity) : capacity_(capacity > 0 ? capacity : 1), next_seq_(1) {}
+
+  void push(Frame& frame){
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame.seq = next_seq_++;
+    frames_.push_back(frame);
+    while (int(frames_.size()) > capacity_) frames_.pop_front();
+  }
+
+  // frames with a sequence number greater than 'since'
+  std::vector<Frame> since(long since) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Frame> out;
+    for (std::deque<Frame>::const_iterator it = frames_.begin(); it != frames_.end(); ++it)
+      if (it->seq > since) out.push_back(*it);
+    return out;
+  }
+
+private:
+  int capacity_;
+  long next_seq_;
+  std::deque<Frame> frames_;
+  mutable std::mutex mutex_;
+};
+
+enum JobStatus { JOB_PENDING, JOB_RUNNING, JOB_DONE, JOB_CANCELLED, JOB_ERROR };
+
+inline const char* job_status_name(JobStatus status){
+  switch (status){
+  case JOB_PENDING: return "pending";
+  case JOB_RUNNING: return "running";
+  case JOB_DONE: return "done";
+  case JOB_CANCELLED: return "cancelled";
+  case JOB_ERROR: return "error";
+  }
+  return "unknown";
+}
+
+struct JobProgress {
+  JobStatus status;
+  int done, total;      // scheduled steps
+  int step;             // last completed time step
+  Date date;
+  std::vector<long> infected;   // infected individuals per host
+  long infected_cells;
+  std::string error;
+};
+
+// yearly outputs: infected grid of each host at each output step
+struct YearlyOutput {
+  int year;
+  int step;
+  std::vector<SparseLayer> I;         // infected hosts per host; I[h].cells() is the infected area
+  std::vector<ZonalSummary> zonal;    // one per zone index of the job
+  Window window;                      // part of the study area used so far (Simulation::touched_window())
+};
+
+class SimulationJob : private StepObserver {
+public:
+  SimulationJob(Simulation* sim, const Schedule& schedule, std::shared_ptr<WeatherSource> weather,
+                const JobOptions& options = JobOptions())
+    : sim_(sim), schedule_(schedule), weather_(weather), options_(options),
+      frames_(options.frame_capacity), cancel_(false),
+      outputs_(new std::vector<YearlyOutput>()), prefix_(new std::vector<YearlyOutput>()){
+    progress_.status = JOB_PENDING;
+    progress_.done = 0;
+    progress_.total = int(schedule_.events().size());
+    progress_.step = 0;
+    progress_.date = Date();
+    progress_.infected_cells = 0;
+  }
+
+  ~SimulationJob(){
+    cancel();
+    join();
+  }
+
+  void start(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (progress_.status != JOB_PENDING) return;
+    progress_.status = JOB_RUNNING;
+    worker_ = std::thread(&SimulationJob::work, this);
+  }
+
+  // ask the worker to stop after the current step
+  void cancel(){ cancel_ = true; }
+
+  void join(){
+    if (worker_.joinable()) worker_.join();
+  }
+
+  JobProgress progress() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return progress_;
+  }
+
+  bool finished() const {
+    JobStatus s = progress().status;
+    return s == JOB_DONE || s == JOB_CANCELLED || s == JOB_ERROR;
+  }
+
+  std::vector<Frame> frames(long since) const { return frames_.since(since); }
+
+  // only valid once the job has finished
+  const std::vector<YearlyOutput>& outputs() const { return *outputs_; }
+  const Simulation& simulation() const { return *sim_; }
+  // outputs of the parent jobs, before those of this job
+  const std::vector<YearlyOutput>& prefix() const { return *prefix_; }
+
+  // Child job (not started) running the events of 'schedule' from the final
+  // state of this finished job, on random stream 'stream' (see
+  // Simulation::fork) and with 'weather' (NULL = the weather of this job).
+  SimulationJob* fork(const Schedule& schedule, uint64_t stream, std::shared_ptr<WeatherSource> weather) const {
+    JobStatus s = progress().status;
+    if (s != JOB_DONE) throw std::invalid_argument("only a job that ran to completion can be forked");
+    SimulationJob* child = new SimulationJob(new Simulation(sim_->fork(stream)), schedule,
+                                             weather ? weather : weather_, options_);
+    if (prefix_->empty()){
+      child->prefix_ = outputs_;
+    }else if (outputs_->empty()){
+      child->prefix_ = prefix_;
+    }else{
+      std::shared_ptr<std::vector<YearlyOutput> > all(new std::vector<YearlyOutput>(*prefix_));
+      all->insert(all->end(), outputs_->begin(), outputs_->end());
+      child->prefix_ = all;
+    }
+    return child;
+  }
+
+private:
+  void work(){
+    JobStatus status = JOB_DONE;
+    std::string error;
+    try {
+      if (!run_strips(*sim_, schedule_, *weather_, *this, options_.domains)) status = JOB_CANCELLED;
+    } catch (std::exception& e){
+      status = JOB_ERROR;
+      error = e.what();
+    } catch (...){
+      status = JOB_ERROR;
+      error = "unknown error in simulation job";
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_.status = status;
+    progress_.error = error;
+  }
+
+  bool cancelled(){ return cancel_; }
+
+  void output(const ScheduledStep& e, const Simulation& sim){
+    YearlyOutput out;
+    out.year = e.date.year;
+    out.step = e.step;
+    for (int h = 0; h < sim.nhosts(); h++)
+      out.I.push_back(SparseLayer::encode(sim.infected(h), sim.infected_cells()));
+    for (std::size_t z = 0; z < options_.zones.size(); z++) out.zonal.push_back(options_.zones[z]->summarize(out.I));
+    out.window = sim.touched_window();
+    outputs_->push_back(out);
+    if (options_.frame_every == 0) push_frame(e, sim);
+  }
+
+  void step_done(const ScheduledStep& e, const Simulation& sim, int done, int total){
+    if (options_.frame_every > 0 && (done % options_.frame_every == 0 || done == total))
+      push_frame(e, sim);
+    std::lock_guard<std::mutex> lock(mutex_);
+    progress_.done = done;
+    progress_.total = total;
+    progress_.step = e.step;
+    progress_.date = e.date;
+    progress_.infected.resize(sim.nhosts());
+    for (int h = 0; h < sim.nhosts(); h++) progress_.infected[h] = sim.infected_total(h);
+    progress_.infected_cells = long(sim.infected_cells().size());
+  }
+
+  void push_frame(const ScheduledStep& e, const Simulation& sim){
+    Frame frame;
+    frame.step = e.step;
+    frame.date = e.date;
+    downsample(sim, options_.frame_max_dim, frame);
+    frames_.push(frame);
+  }
+
+  std::unique_ptr<Simulation> sim_;
+  Schedule schedule_;
+  std::shared_ptr<WeatherSource> weather_;   // shared with the forks of the job
+  JobOptions options_;
+  FrameBuffer frames_;
+  std::atomic<bool> cancel_;
+  std::thread worker_;
+  mutable std::mutex mutex_;
+  JobProgress progress_;
+  std::shared_ptr<std::vector<YearlyOutput> > outputs_;
+  std::shared_ptr<const std::vector<YearlyOutput> > prefix_;
+};
+
+} // namespace pops
+
+#endif
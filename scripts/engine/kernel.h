@@ -0,0 +1,210 @@
+#ifndef POPS_ENGINE_KERNEL_H
+#define POPS_ENGINE_KERNEL_H
+
+// Dispersal kernels of the native engine: distance and direction of a
+// dispersed spore unit, same parameterization as SporeDispCpp_mh and
+// SporeDispCppWind_mh (distance in map units, direction in radians clockwise
+// from north).
+//
+// Each kernel gives the distribution of the distance travelled (sampler, CDF
+// and inverse CDF, which kernel_table.h uses to build the discretized kernel);
+// the direction is uniform, or von Mises around the wind direction. The
+// kernels (kernel_registry()) are:
+//  - Cauchy:         half-Cauchy with scale scale1
+//  - Cauchy Mixture: scale1 with probability gamma, else scale2
+//  - Exponential:    mean scale1
+//  - Gauss:          half-normal with standard deviation scale1 (distGen with mean 0)
+//  - Power Law:      Lomax (Pareto II), P(d > x) = (1 + x / scale1)^-shape
+//  - Log Normal:     median scale1, standard deviation of the log shape
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "rng.h"
+
+namespace pops {
+
+enum KernelType { KERNEL_CAUCHY, KERNEL_CAUCHY_MIXTURE, KERNEL_EXPONENTIAL, KERNEL_GAUSS, KERNEL_POWER_LAW,
+                  KERNEL_LOG_NORMAL };
+
+// name of a kernel (kernelType in R) and the parameters it uses besides scale1
+struct KernelInfo {
+  KernelType type;
+  const char* name;
+  bool scale2;
+  bool gamma;
+  bool shape;
+};
+
+inline const KernelInfo* kernel_registry(int& count){
+  static const KernelInfo kernels[] = {
+    {KERNEL_CAUCHY, "Cauchy", false, false, false},
+    {KERNEL_CAUCHY_MIXTURE, "Cauchy Mixture", true, true, false},
+    {KERNEL_EXPONENTIAL, "Exponential", false, false, false},
+    {KERNEL_GAUSS, "Gauss", false, false, false},
+    {KERNEL_POWER_LAW, "Power Law", false, false, true},
+    {KERNEL_LOG_NORMAL, "Log Normal", false, false, true}
+  };
+  count = int(sizeof(kernels) / sizeof(kernels[0]));
+  return kernels;
+}
+
+inline const KernelInfo& kernel_info(KernelType type){
+  int n;
+  const KernelInfo* kernels = kernel_registry(n);
+  for (int i = 0; i < n; i++)
+    if (kernels[i].type == type) return kernels[i];
+  throw std::invalid_argument("unknown kernel type");
+}
+
+inline KernelType kernel_type(const std::string& name){
+  int n;
+  const KernelInfo* kernels = kernel_registry(n);
+  std::string names;
+  for (int i = 0; i < n; i++){
+    if (name == kernels[i].name) return kernels[i].type;
+    names += std::string(i == 0 ? "'" : (i + 1 < n ? ", '" : " or '")) + kernels[i].name + "'";
+  }
+  throw std::invalid_argument("The parameter kernelType must be set to either " + names);
+}
+
+// predominant wind direction (N, NE, ..., NW) in degrees
+inline double wind_direction(const std::string& wdir){
+  static const char* dirs[] = {"N", "NE", "E", "SE", "S", "SW", "W", "NW"};
+  for (int i = 0; i < 8; i++)
+    if (wdir == dirs[i]) return 45.0 * i;
+  throw std::invalid_argument("A predominant wind direction must be specified: N, NE, E, SE, S, SW, W, NW");
+}
+
+// standard normal distribution and its inverse (Acklam's approximation
+// refined by one Halley step)
+inline double normal_cdf(double x){
+  return 0.5 * std::erfc(-x / std::sqrt(2.0));
+}
+
+inline double normal_quantile(double p){
+  if (p <= 0) return -HUGE_VAL;
+  if (p >= 1) return HUGE_VAL;
+  static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                             1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                             6.680131188771972e+01, -1.328068155288572e+01};
+  static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                             -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                             3.754408661907416e+00};
+  double x;
+  if (p < 0.02425){
+    double q = std::sqrt(-2 * std::log(p));
+    x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+        ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }else if (p > 1 - 0.02425){
+    double q = std::sqrt(-2 * std::log(1 - p));
+    x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+         ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }else{
+    double q = p - 0.5, r = q * q;
+    x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+        (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+  }
+  double e = normal_cdf(x) - p;
+  double u = e * std::sqrt(2 * pi) * std::exp(x * x / 2);
+  return x - u / (1 + x * u / 2);
+}
+
+struct Kernel {
+  KernelType type;
+  double scale1;
+  double scale2;
+  double gamma;       // weight of the first component of the Cauchy mixture
+  double shape;       // exponent of the power law, log standard deviation of the log-normal
+  bool wind;
+  double wind_dir;    // mean direction (radians)
+  double kappa;       // von Mises concentration
+
+  void validate() const {
+    const KernelInfo& info = kernel_info(type);
+    if (!(scale1 > 0)) throw std::invalid_argument("scale1 must be greater than zero");
+    if (info.gamma && (gamma >= 1 || gamma <= 0)) throw std::invalid_argument("The parameter gamma must range between (0-1)");
+    if (info.scale2 && !(scale2 > 0))
+      throw std::invalid_argument(std::string("scale2 must be greater than zero for a '") + info.name + "' kernel");
+    if (info.shape && !(shape > 0))
+      throw std::invalid_argument(std::string("shape must be greater than zero for a '") + info.name + "' kernel");
+    if (wind && kappa <= 0) throw std::invalid_argument("kappa must be greater than zero!");
+  }
+
+  double distance(Rng& rng) const {
+    switch (type){
+    case KERNEL_CAUCHY:
+      return std::fabs(rng.cauchy(scale1));
+    case KERNEL_CAUCHY_MIXTURE:
+      return std::fabs(rng.cauchy(rng.uniform() < gamma ? scale1 : scale2));
+    case KERNEL_EXPONENTIAL:
+      return rng.exponential(scale1);
+    case KERNEL_GAUSS:
+      return std::fabs(rng.normal()) * scale1;
+    case KERNEL_POWER_LAW:
+      return quantile(rng.uniform());
+    case KERNEL_LOG_NORMAL:
+      return scale1 * std::exp(shape * rng.normal());
+    }
+    return 0;
+  }
+
+  // probability that a spore travels at most d
+  double cdf(double d) const {
+    switch (type){
+    case KERNEL_CAUCHY:
+      return 2 / pi * std::atan(d / scale1);
+    case KERNEL_CAUCHY_MIXTURE:
+      return gamma * 2 / pi * std::atan(d / scale1) + (1 - gamma) * 2 / pi * std::atan(d / scale2);
+    case KERNEL_EXPONENTIAL:
+      return 1 - std::exp(-d / scale1);
+    case KERNEL_GAUSS:
+      return std::erf(d / (scale1 * std::sqrt(2.0)));
+    case KERNEL_POWER_LAW:
+      return 1 - std::pow(1 + d / scale1, -shape);
+    case KERNEL_LOG_NORMAL:
+      return d > 0 ? normal_cdf(std::log(d / scale1) / shape) : 0;
+    }
+    return 1;
+  }
+
+  // distance travelled with probability p or less (inverse of cdf)
+  double quantile(double p) const {
+    switch (type){
+    case KERNEL_CAUCHY:
+      return scale1 * std::tan(pi / 2 * p);
+    case KERNEL_CAUCHY_MIXTURE: {
+      // no closed form: bisect between the quantiles of the two components
+      double lo = std::min(scale1, scale2) * std::tan(pi / 2 * p);
+      double hi = std::max(scale1, scale2) * std::tan(pi / 2 * p);
+      for (int i = 0; i < 100 && hi - lo > 1e-9 * hi; i++){
+        double mid = (lo + hi) / 2;
+        if (cdf(mid) < p) lo = mid; else hi = mid;
+      }
+      return (lo + hi) / 2;
+    }
+    case KERNEL_EXPONENTIAL:
+      return -scale1 * std::log(1 - p);
+    case KERNEL_GAUSS:
+      return scale1 * normal_quantile((1 + p) / 2);
+    case KERNEL_POWER_LAW:
+      return scale1 * (std::pow(1 - p, -1 / shape) - 1);
+    case KERNEL_LOG_NORMAL:
+      return scale1 * std::exp(shape * normal_quantile(p));
+    }
+    return 0;
+  }
+
+  double direction(Rng& rng) const {
+    if (wind) return rng.von_mises(wind_dir, kappa);
+    return rng.uniform(-pi, pi);
+  }
+};
+
+} // namespace pops
+
+#endif
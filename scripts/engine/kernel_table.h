@@ -0,0 +1,266 @@
+#ifndef POPS_ENGINE_KERNEL_TABLE_H
+#define POPS_ENGINE_KERNEL_TABLE_H
+
+// Discretized dispersal kernel and the process-wide cache of such tables.
+//
+// A spore sampled from the kernel (distance, then direction) ends up in the
+// cell offset (-round(d cos theta / res), round(d sin theta / res)) from its
+// source. Up to a truncation radius the table holds the probability of every
+// such offset, integrated over thin rings split where they cross cell edges,
+// and draws one with an alias table: two uniforms and a lookup per spore
+// instead of the kernel, direction and trigonometry. A spore whose draw falls
+// past the radius (the tail of the kernel) is sampled directly from the
+// inverse CDF, so the table does not cut the long-distance dispersal.
+//
+// Building a table takes a fraction of a second for a large radius; runs of a
+// calibration or ensemble share the kernel, so tables are cached by kernel
+// parameters and cell size and reused by every simulation of the process.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "kernel.h"
+#include "rng.h"
+
+namespace pops {
+
+class KernelTable {
+public:
+  // max_radius: truncation radius in cells
+  KernelTable(const Kernel& kernel, double res, int max_radius = 256)
+    : kernel_(kernel), res_(res){
+    kernel_.validate();
+    if (!(res > 0)) throw std::invalid_argument("the cell size must be greater than zero");
+    reach_ = std::min(kernel_.quantile(1 - 1e-5), max_radius * res);
+    inner_ = kernel_.cdf(reach_);
+    int R = int(std::ceil(reach_ / res + 0.5));
+    int width = 2 * R + 1;
+    std::vector<double> window(std::size_t(width) * width, 0.0);
+
+    if (kernel_.wind) direction_cdf();
+    // rings of res/128 near the source, where a cell covers a wide angle and
+    // most of the mass, then of res/16
+    std::vector<double> edges(1, 0.0);
+    while (edges.back() < reach_)
+      edges.push_back(std::min(reach_, edges.back() + (edges.back() < 4 * res ? res / 128 : res / 16)));
+    std::vector<double> cuts;
+    for (std::size_t i = 0; i + 1 < edges.size(); i++){
+      double d0 = edges[i], d1 = edges[i + 1];
+      double mass = kernel_.cdf(d1) - kernel_.cdf(d0);
+      if (!(mass > 0)) continue;
+      // the circle through the middle of the ring crosses the cell edges at
+      // these angles; each arc between two crossings lies in a single cell
+      double d = (d0 + d1) / 2;
+      cuts.clear();
+      cuts.push_back(-pi);
+      cuts.push_back(pi);
+      for (int k = -R; k < R; k++){
+        double c = (k + 0.5) * res / d;
+        if (c <= -1 || c >= 1) continue;
+        double t = std::acos(c);       // edge between rows
+        cuts.push_back(t);
+        cuts.push_back(-t);
+        t = std::asin(c);              // edge between columns
+        cuts.push_back(t);
+        cuts.push_back(t > 0 ? pi - t : -pi - t);
+      }
+      std::sort(cuts.begin(), cuts.end());
+      for (std::size_t j = 0; j + 1 < cuts.size(); j++){
+        double t0 = cuts[j], t1 = cuts[j + 1];
+        if (!(t1 > t0)) continue;
+        double theta = (t0 + t1) / 2;
+        int dr = -int(std::floor(d * std::cos(theta) / res + 0.5));
+        int dc = int(std::floor(d * std::sin(theta) / res + 0.5));
+        window[std::size_t(dr + R) * width + (dc + R)] += mass * arc(t0, t1);
+      }
+    }
+
+    // offsets with some probability, normalized within the radius
+    double total = 0;
+    for (std::size_t k = 0; k < window.size(); k++) total += window[k];
+    std::vector<double> p;
+    for (std::size_t k = 0; k < window.size(); k++){
+      if (!(window[k] > 0)) continue;
+      drow_.push_back(int(k / width) - R);
+      dcol_.push_back(int(k % width) - R);
+      p.push_back(window[k] / total);
+    }
+    alias(p);
+  }
+
+  const Kernel& kernel() const { return kernel_; }
+  double res() const { return res_; }
+  // truncation radius (map units) and probability of a spore staying within it
+  double reach() const { return reach_; }
+  double inner() const { return inner_; }
+  std::size_t size() const { return prob_.size(); }
+
+  // cell offset reached by a spore
+  void sample(Rng& rng, int& drow, int& dcol) const {
+    double u = rng.uniform();
+    if (u < inner_){
+      double x = rng.uniform() * prob_.size();
+      std::size_t k = std::min(std::size_t(x), prob_.size() - 1);
+      if (x - double(k) >= prob_[k]) k = alias_[k];
+      drow = drow_[k];
+      dcol = dcol_[k];
+      return;
+    }
+    // tail of the kernel: u is uniform on (cdf(reach), 1)
+    double d = kernel_.quantile(u);
+    double theta = kernel_.direction(rng);
+    drow = -int(std::floor(d * std::cos(theta) / res_ + 0.5));
+    dcol = int(std::floor(d * std::sin(theta) / res_ + 0.5));
+  }
+
+private:
+  // cumulative von Mises distribution around the wind direction, on a fine grid
+  void direction_cdf(){
+    const int n = 4096;
+    cdf_.assign(n + 1, 0.0);
+    double prev = std::exp(kernel_.kappa * (std::cos(-pi) - 1));
+    for (int i = 1; i <= n; i++){
+      double f = std::exp(kernel_.kappa * (std::cos(-pi + 2 * pi * i / n) - 1));
+      cdf_[i] = cdf_[i - 1] + (prev + f) / 2;
+      prev = f;
+    }
+    for (int i = 1; i <= n; i++) cdf_[i] /= cdf_[n];
+  }
+
+  // probability of a direction between t0 and t1 (t1 - t0 < 2 pi)
+  double arc(double t0, double t1) const {
+    if (!kernel_.wind) return (t1 - t0) / (2 * pi);
+    double a = std::remainder(t0 - kernel_.wind_dir, 2 * pi);
+    double b = a + (t1 - t0);
+    if (b <= pi) return direction_at(b) - direction_at(a);
+    return 1 - direction_at(a) + direction_at(b - 2 * pi);
+  }
+
+  double direction_at(double rel) const {
+    double x = (rel + pi) / (2 * pi) * (cdf_.size() - 1);
+    std::size_t i = std::min(std::size_t(std::max(x, 0.0)), cdf_.size() - 2);
+    double f = x - double(i);
+    return cdf_[i] + f * (cdf_[i + 1] - cdf_[i]);
+  }
+
+  // Vose's alias method
+  void alias(const std::vector<double>& p){
+    std::size_t n = p.size();
+    prob_.assign(n, 1.0);
+    alias_.assign(n, 0);
+    std::vector<double> scaled(n);
+    std::vector<std::size_t> small, large;
+    for (std::size_t k = 0; k < n; k++){
+      scaled[k] = p[k] * n;
+      (scaled[k] < 1 ? small : large).push_back(k);
+    }
+    while (!small.empty() && !large.empty()){
+      std::size_t s = small.back(), l = large.back();
+      small.pop_back();
+      prob_[s] = scaled[s];
+      alias_[s] = int(l);
+      scaled[l] -= 1 - scaled[s];
+      if (scaled[l] < 1){
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+  }
+
+  Kernel kernel_;
+  double res_;
+  double reach_, inner_;
+  std::vector<double> cdf_;
+  std::vector<int> drow_, dcol_;
+  std::vector<double> prob_;
+  std::vector<int> alias_;
+};
+
+// parameters a table depends on; those a kernel type does not use (see
+// kernel_registry()) are zeroed so that e.g. Cauchy runs with different gamma
+// share a table
+struct KernelKey {
+  int type;
+  double scale1, scale2, gamma, shape;
+  bool wind;
+  double wind_dir, kappa;
+  double res;
+
+  KernelKey(const Kernel& k, double res)
+    : type(k.type), scale1(k.scale1), scale2(kernel_info(k.type).scale2 ? k.scale2 : 0),
+      gamma(kernel_info(k.type).gamma ? k.gamma : 0), shape(kernel_info(k.type).shape ? k.shape : 0),
+      wind(k.wind), wind_dir(k.wind ? k.wind_dir : 0), kappa(k.wind ? k.kappa : 0), res(res) {}
+
+  bool operator==(const KernelKey& o) const {
+    return type == o.type && scale1 == o.scale1 && scale2 == o.scale2 && gamma == o.gamma && shape == o.shape &&
+      wind == o.wind && wind_dir == o.wind_dir && kappa == o.kappa && res == o.res;
+  }
+};
+
+struct KernelCacheStats {
+  std::size_t tables;
+  long hits, misses;
+};
+
+// The most recently used tables of the process (a sweep over scale1 would
+// otherwise keep one table per value); thread safe.
+class KernelCache {
+public:
+  explicit KernelCache(std::size_t capacity = 8) : capacity_(capacity), hits_(0), misses_(0) {}
+
+  std::shared_ptr<const KernelTable> get(const Kernel& kernel, double res){
+    KernelKey key(kernel, res);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Entries::iterator it = entries_.begin(); it != entries_.end(); ++it){
+        if (it->first == key){
+          entries_.splice(entries_.begin(), entries_, it);
+          hits_++;
+          return entries_.front().second;
+        }
+      }
+      misses_++;
+    }
+    // built outside of the lock; two threads missing at once both build it
+    std::shared_ptr<const KernelTable> table(new KernelTable(kernel, res));
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_front(std::make_pair(key, table));
+    while (entries_.size() > capacity_) entries_.pop_back();
+    return table;
+  }
+
+  KernelCacheStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    KernelCacheStats s = {entries_.size(), hits_, misses_};
+    return s;
+  }
+
+  void clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+  }
+
+private:
+  typedef std::list<std::pair<KernelKey, std::shared_ptr<const KernelTable> > > Entries;
+  std::size_t capacity_;
+  Entries entries_;
+  long hits_, misses_;
+  mutable std::mutex mutex_;
+};
+
+// cache shared by all the simulations of the process
+inline KernelCache& kernel_cache(){
+  static KernelCache cache;
+  return cache;
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef POPS_ENGINE_LANDSCAPE_PACK_H
+#define POPS_ENGINE_LANDSCAPE_PACK_H
+
+// Landscape packs: the host grids of a study area preprocessed into one binary
+// file.
+//
+// Every run used to load the host rasters, allTrees and initialPopulation,
+// replace missing values and convert them to matrices before the simulation
+// could start. A pack holds those grids already aligned and cleaned, so a run
+// only maps the file (POSIX mmap; the file is read into memory elsewhere) and
+// copies the grids it needs.
+//
+// Layout (native byte order, little endian on every supported platform):
+//   header   PackHeader (72 bytes)
+//   crs      crs_length bytes, padded with zeros to a multiple of 8
+//   grids    int32 row-major grids of nrow x ncol cells: allTrees, initial
+//            population, then host 1..nhosts
+// The checksum (64-bit FNV-1a) covers everything after the header, so a
+// truncated or modified pack is refused.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace pops {
+
+struct PackHeader {
+  char magic[8];            // "POPSPACK"
+  uint32_t version;
+  uint32_t nhosts;
+  int32_t nrow, ncol;
+  double xmin, xmax, ymin, ymax;
+  uint64_t checksum;
+  uint32_t crs_length;
+  uint32_t reserved;
+};
+
+// extent and projection of the grids (as the rasters they came from)
+struct PackGeometry {
+  double xmin, xmax, ymin, ymax;
+  std::string crs;
+};
+
+// infected hosts at the start of a run, with the initial infection rule of
+// pest(): where the initial population is y > 0 a host with x individuals has
+// min(x, 2y) infected if x > y, else all x; they are taken from S
+inline void initial_infection(std::vector<int>& S, const std::vector<int>& initial, std::vector<int>& I){
+  I.assign(S.size(), 0);
+  for (std::size_t cell = 0; cell < S.size(); cell++){
+    int x = S[cell], y = initial[cell];
+    if (y <= 0 || x <= 0) continue;
+    I[cell] = x > y ? std::min(x, 2 * y) : x;
+    S[cell] -= I[cell];
+  }
+}
+
+inline uint64_t fnv1a(const unsigned char* data, std::size_t n, uint64_t hash = 14695981039346656037ULL){
+  for (std::size_t k = 0; k < n; k++){
+    hash ^= data[k];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+class LandscapePack {
+public:
+  static const uint32_t VERSION = 1;
+
+  // write a pack; grids are row-major nrow x ncol, missing values already set to 0
+  static void write(const std::string& path, int nrow, int ncol, const PackGeometry& geometry,
+                    const std::vector<int>& all_trees, const std::vector<int>& initial,
+                    const std::vector<std::vector<int> >& hosts){
+    std::size_t ncell = std::size_t(nrow) * ncol;
+    if (nrow < 1 || ncol < 1) throw std::invalid_argument("the landscape must have at least one cell");
+    if (hosts.empty()) throw std::invalid_argument("the landscape needs at least one host");
+    check_grid(all_trees, ncell, "allTrees");
+    check_grid(initial, ncell, "initialPopulation");
+    for (std::size_t h = 0; h < hosts.size(); h++) check_grid(hosts[h], ncell, "host");
+
+    std::vector<unsigned char> body(padded(geometry.crs.size()), 0);
+    std::memcpy(body.data(), geometry.crs.data(), geometry.crs.size());
+    append(body, all_trees);
+    append(body, initial);
+    for (std::size_t h = 0; h < hosts.size(); h++) append(body, hosts[h]);
+
+    PackHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "POPSPACK", 8);
+    header.version = VERSION;
+    header.nhosts = uint32_t(hosts.size());
+    header.nrow = nrow;
+    header.ncol = ncol;
+    header.xmin = geometry.xmin;
+    header.xmax = geometry.xmax;
+    header.ymin = geometry.ymin;
+    header.ymax = geometry.ymax;
+    header.crs_length = uint32_t(geometry.crs.size());
+    header.checksum = fnv1a(body.data(), body.size());
+
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot create the landscape pack " + path);
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 && std::fwrite(body.data(), 1, body.size(), f) == body.size();
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) throw std::runtime_error("cannot write the landscape pack " + path);
+  }
+
+  // map a pack; verify = false skips the checksum (which reads the whole file)
+  explicit LandscapePack(const std::string& path, bool verify = true) : data_(0), size_(0), mapped_(false){
+    open(path);
+    try {
+      if (size_ < sizeof(PackHeader)) throw std::runtime_error("not a landscape pack: " + path);
+      std::memcpy(&header_, data_, sizeof(header_));
+      if (std::memcmp(header_.magic, "POPSPACK", 8) != 0) throw std::runtime_error("not a landscape pack: " + path);
+      if (header_.version != VERSION) throw std::runtime_error("unsupported landscape pack version in " + path);
+      if (header_.nrow < 1 || header_.ncol < 1 || header_.nhosts < 1) throw std::runtime_error("corrupt landscape pack " + path);
+      std::size_t expected = sizeof(PackHeader) + padded(header_.crs_length) + (2 + std::size_t(header_.nhosts)) * ncell() * 4;
+      if (size_ != expected) throw std::runtime_error("the landscape pack " + path + " is truncated or corrupt");
+      if (verify && fnv1a(data_ + sizeof(PackHeader), size_ - sizeof(PackHeader)) != header_.checksum)
+        throw std::runtime_error("checksum mismatch in the landscape pack " + path);
+    } catch (...) {
+      close();
+      throw;
+    }
+  }
+
+  ~LandscapePack(){ close(); }
+
+  int nrow() const { return header_.nrow; }
+  int ncol() const { return header_.ncol; }
+  std::size_t ncell() const { return std::size_t(header_.nrow) * header_.ncol; }
+  int nhosts() const { return int(header_.nhosts); }
+  uint64_t checksum() const { return header_.checksum; }
+  PackGeometry geometry() const {
+    PackGeometry g = {header_.xmin, header_.xmax, header_.ymin, header_.ymax,
+                      std::string(reinterpret_cast<const char*>(data_ + sizeof(PackHeader)), header_.crs_length)};
+    return g;
+  }
+
+  // the grids, or their rows [row0, row1) only (row1 = -1: to the last row);
+  // the other rows of the file are not touched
+  std::vector<int> all_trees(int row0 = 0, int row1 = -1) const { return grid(0, row0, row1); }
+  std::vector<int> initial(int row0 = 0, int row1 = -1) const { return grid(1, row0, row1); }
+  std::vector<int> host(int h, int row0 = 0, int row1 = -1) const {
+    if (h < 0 || h >= nhosts()) throw std::out_of_range("the landscape pack has no such host");
+    return grid(2 + h, row0, row1);
+  }
+
+  // susceptible and infected hosts 0..nhosts-1 at the start of a run (see
+  // initial_infection()), in the rows [row0, row1)
+  void initial_state(int nhosts, std::vector<std::vector<int> >& S, std::vector<std::vector<int> >& I,
+                     int row0 = 0, int row1 = -1) const {
+    if (nhosts < 1 || nhosts > this->nhosts()) throw std::invalid_argument("the landscape pack does not hold that many hosts");
+    std::vector<int> init = initial(row0, row1);
+    S.assign(nhosts, std::vector<int>());
+    I.assign(nhosts, std::vector<int>());
+    for (int h = 0; h < nhosts; h++){
+      S[h] = host(h, row0, row1);
+      initial_infection(S[h], init, I[h]);
+    }
+  }
+
+private:
+  LandscapePack(const LandscapePack&);
+  LandscapePack& operator=(const LandscapePack&);
+
+  static std::size_t padded(std::size_t n){ return (n + 7) / 8 * 8; }
+
+  static void check_grid(const std::vector<int>& grid, std::size_t ncell, const char* what){
+    if (grid.size() != ncell) throw std::invalid_argument(std::string(what) + " grids must all have the same dimensions");
+    for (std::size_t cell = 0; cell < ncell; cell++)
+      if (grid[cell] < 0) throw std::invalid_argument(std::string(what) + " grids must not hold negative values");
+  }
+
+  static void append(std::vector<unsigned char>& body, const std::vector<int>& grid){
+    std::size_t at = body.size();
+    body.resize(at + grid.size() * 4);
+    for (std::size_t k = 0; k < grid.size(); k++){
+      int32_t v = int32_t(grid[k]);
+      std::memcpy(&body[at + k * 4], &v, 4);
+    }
+  }
+
+  std::vector<int> grid(int k, int row0, int row1) const {
+    if (row1 < 0) row1 = nrow();
+    if (row0 < 0 || row0 > row1 || row1 > nrow()) throw std::out_of_range("rows outside of the landscape pack");
+    const unsigned char* p = data_ + sizeof(PackHeader) + padded(header_.crs_length) + std::size_t(k) * ncell() * 4
+                             + std::size_t(row0) * ncol() * 4;
+    std::vector<int> out(std::size_t(row1 - row0) * ncol());
+    for (std::size_t cell = 0; cell < out.size(); cell++){
+      int32_t v;
+      std::memcpy(&v, p + cell * 4, 4);
+      out[cell] = int(v);
+    }
+    return out;
+  }
+
+  void open(const std::string& path){
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open the landscape pack " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0){
+      ::close(fd);
+      throw std::runtime_error("cannot open the landscape pack " + path);
+    }
+    size_ = std::size_t(st.st_size);
+    void* p = size_ > 0 ? mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p != MAP_FAILED){
+      data_ = static_cast<const unsigned char*>(p);
+      mapped_ = true;
+      return;
+    }
+#endif
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) throw std::runtime_error("cannot open the landscape pack " + path);
+    unsigned char chunk[65536];
+    std::size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) buffer_.insert(buffer_.end(), chunk, chunk + n);
+    std::fclose(f);
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+  void close(){
+#ifndef _WIN32
+    if (mapped_) munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    mapped_ = false;
+    data_ = 0;
+    buffer_.clear();
+  }
+
+  PackHeader header_;
+  const unsigned char* data_;
+  std::size_t size_;
+  bool mapped_;
+  std::vector<unsigned char> buffer_;
+};
+
+} // namespace pops
+
+#endif
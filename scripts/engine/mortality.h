@@ -0,0 +1,75 @@
+#ifndef POPS_ENGINE_MORTALITY_H
+#define POPS_ENGINE_MORTALITY_H
+
+// Cold-temperature mortality/recovery stage.
+//
+// Once a year the critical (minimum) temperature layer for that year is compared
+// against the lethal threshold of each host. In cells colder than the threshold
+// all infected individuals of that host are cleared and returned to the
+// susceptible pool, which is what pest() used to do for host 1 only with
+// `crit_temp[,,crit_cnt] < -12.87`.
+//
+// The stage only visits cells that currently hold infected hosts, so its cost
+// scales with the size of the outbreak rather than with the size of the grid.
+// Grids are updated in place; the stage works on any cell layout (column-major
+// from R, row-major in the engine) as long as all grids share it.
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace pops {
+
+// non-owning view on the susceptible/infected grids of one host
+struct HostGrids {
+  int* S;
+  int* I;
+  double lethal_temp;   // NaN = host is not affected by cold
+};
+
+// collect the (0-based) index of every cell with infected hosts
+inline void infected_cells(const std::vector<HostGrids>& hosts, std::size_t ncell,
+                           std::vector<int>& cells){
+  cells.clear();
+  for (std::size_t cell = 0; cell < ncell; cell++){
+    for (std::size_t h = 0; h < hosts.size(); h++){
+      if (hosts[h].I[cell] > 0){
+        cells.push_back(static_cast<int>(cell));
+        break;
+      }
+    }
+  }
+}
+
+// Apply the mortality stage over the given infected cells.
+// 'removed' receives the number of infected individuals cleared per host and
+// 'cells' is compacted to the cells that are still infected afterwards.
+template <typename T>
+inline void cold_mortality(std::vector<HostGrids>& hosts, const T* crit_temp,
+                           std::vector<int>& cells, std::vector<long>& removed){
+  removed.assign(hosts.size(), 0);
+  std::size_t kept = 0;
+  for (std::size_t k = 0; k < cells.size(); k++){
+    int cell = cells[k];
+    double t = crit_temp[cell];
+    bool still_infected = false;
+    for (std::size_t h = 0; h < hosts.size(); h++){
+      int inf = hosts[h].I[cell];
+      if (inf <= 0) continue;
+      // comparisons against NaN (missing temperature or unset threshold) are false
+      if (t < hosts[h].lethal_temp){
+        hosts[h].S[cell] += inf;
+        hosts[h].I[cell] = 0;
+        removed[h] += inf;
+      }else{
+        still_infected = true;
+      }
+    }
+    if (still_infected) cells[kept++] = cell;
+  }
+  cells.resize(kept);
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef POPS_ENGINE_PLATFORM_H
+#define POPS_ENGINE_PLATFORM_H
+
+// Build and CPU features of the engine.
+//
+// The per-cell loops over whole grids (weather coefficients, weather ranking)
+// are marked POPS_MULTIVERSION: with GCC on x86-64 Linux they are compiled
+// once for AVX2 and once for the baseline instruction set, and the loader
+// picks the version the CPU supports, so one build is fast on recent machines
+// and still runs on old ones. A build for a given machine (-march, see
+// popsengine/src/Makevars.in) does not need this and turns it off.
+
+#include <string>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && defined(__x86_64__) && defined(__linux__) && \
+    !defined(__AVX2__) && !defined(POPS_NO_MULTIVERSION)
+#define POPS_MULTIVERSION __attribute__((target_clones("avx2", "default")))
+#define POPS_HAS_MULTIVERSION 1
+#else
+#define POPS_MULTIVERSION
+#define POPS_HAS_MULTIVERSION 0
+#endif
+
+namespace pops {
+
+// cells per block of the multiversioned loops (a block is one call)
+const long GRID_BLOCK = 4096;
+
+struct BuildInfo {
+  bool openmp;           // compiled with OpenMP
+  int threads;           // OpenMP threads available (1 without OpenMP)
+  std::string isa;       // widest instruction set the build assumes
+  bool multiversion;     // grid loops dispatched at run time
+  bool cpu_avx2;         // the CPU running the engine has AVX2
+  bool cpu_ok;           // the CPU supports the instruction set of the build
+};
+
+inline BuildInfo build_info(){
+  BuildInfo info;
+#ifdef _OPENMP
+  info.openmp = true;
+  info.threads = omp_get_max_threads();
+#else
+  info.openmp = false;
+  info.threads = 1;
+#endif
+#if defined(__AVX512F__)
+  info.isa = "avx512f";
+#elif defined(__AVX2__)
+  info.isa = "avx2";
+#elif defined(__AVX__)
+  info.isa = "avx";
+#elif defined(__SSE4_2__)
+  info.isa = "sse4.2";
+#elif defined(__x86_64__)
+  info.isa = "x86-64";
+#else
+  info.isa = "generic";
+#endif
+  info.multiversion = POPS_HAS_MULTIVERSION != 0;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  info.cpu_avx2 = __builtin_cpu_supports("avx2") != 0;
+  info.cpu_ok = true;
+#if defined(__AVX512F__)
+  info.cpu_ok = __builtin_cpu_supports("avx512f") != 0;
+#elif defined(__AVX2__)
+  info.cpu_ok = info.cpu_avx2;
+#elif defined(__AVX__)
+  info.cpu_ok = __builtin_cpu_supports("avx") != 0;
+#elif defined(__SSE4_2__)
+  info.cpu_ok = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+#else
+  info.cpu_avx2 = false;
+  info.cpu_ok = true;
+#endif
+  return info;
+}
+
+} // namespace pops
+
+#endif
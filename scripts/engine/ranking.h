@@ -0,0 +1,138 @@
+#ifndef POPS_ENGINE_RANKING_H
+#define POPS_ENGINE_RANKING_H
+
+// Weather ranking: how favorable each year of a coefficient archive is.
+//
+// The weekly moisture (M) and temperature (C) coefficient layers are streamed
+// one week at a time. The suitability of a week is the sum over cells of M * C
+// (cells with a missing value are skipped). The value of a year is the mean of
+// its weekly totals, as in weatherRanking.r. Years are ranked from the most
+// (rank 1) to the least favorable; climGen samples favorable/unfavorable
+// futures from the upper/lower half of that ranking.
+//
+// Totals can be restricted to a mask or split by sub-region with a zone grid
+// (zone 0 = not counted, zones 1..n = regions); each region is ranked on its
+// own.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include "platform.h"
+
+namespace pops {
+
+struct WeekTotal {
+  int year;
+  int week;
+  int region;
+  double total;
+};
+
+struct YearRank {
+  int year;
+  int region;
+  double value;   // mean weekly suitability
+  int rank;
+};
+
+class WeatherRanking {
+public:
+  // zones: one zone per cell (empty = a single region covering every cell)
+  WeatherRanking(std::size_t ncell, const std::vector<int>& zones = std::vector<int>(), int nregions = 1)
+    : ncell_(ncell), zones_(zones), nregions_(zones.empty() ? 1 : nregions){
+    if (!zones_.empty() && zones_.size() != ncell_) throw std::invalid_argument("the zone grid does not match the coefficient layers");
+    if (nregions_ < 1) throw std::invalid_argument("there must be at least one region");
+    for (std::size_t cell = 0; cell < zones_.size(); cell++)
+      if (zones_[cell] < 0 || zones_[cell] > nregions_) throw std::invalid_argument("zones must range between 0 and the number of regions");
+  }
+
+  // cells of the coefficient layers
+  std::size_t ncell() const { return ncell_; }
+
+  // add the M and C layers of the next week of a year (ncell() cells each)
+  template <typename T>
+  void add_week(int year, const T* M, const T* C){
+    std::vector<double> totals(nregions_, 0.0);
+    long n = long(ncell_);
+    if (zones_.empty()){
+      double total = 0;
+      long blocks = (n + GRID_BLOCK - 1) / GRID_BLOCK;
+      #pragma omp parallel for reduction(+:total) schedule(static)
+      for (long block = 0; block < blocks; block++)
+        total += product_sum(M, C, block * GRID_BLOCK, std::min(n, (block + 1) * GRID_BLOCK));
+      totals[0] = total;
+    }else{
+      #pragma omp parallel
+      {
+        std::vector<double> local(nregions_, 0.0);
+        #pragma omp for schedule(static)
+        for (long cell = 0; cell < n; cell++){
+          int zone = zones_[cell];
+          if (zone == 0) continue;
+          double v = double(M[cell]) * double(C[cell]);
+          if (!std::isnan(v)) local[zone - 1] += v;
+        }
+        #pragma omp critical
+        for (int r = 0; r < nregions_; r++) totals[r] += local[r];
+      }
+    }
+    int week = ++weeks_[year];
+    for (int r = 0; r < nregions_; r++){
+      WeekTotal w = {year, week, r + 1, totals[r]};
+      weekly_.push_back(w);
+    }
+  }
+
+  const std::vector<WeekTotal>& weekly() const { return weekly_; }
+
+  // mean weekly suitability of every year, ranked within each region
+  std::vector<YearRank> ranking() const {
+    std::map<std::pair<int, int>, std::pair<double, int> > sums;   // (region, year) -> (sum, weeks)
+    for (std::size_t k = 0; k < weekly_.size(); k++){
+      std::pair<double, int>& s = sums[std::make_pair(weekly_[k].region, weekly_[k].year)];
+      s.first += weekly_[k].total;
+      s.second++;
+    }
+    std::vector<YearRank> out;
+    for (std::map<std::pair<int, int>, std::pair<double, int> >::const_iterator it = sums.begin(); it != sums.end(); ++it){
+      YearRank y = {it->first.second, it->first.first, it->second.first / it->second.second, 0};
+      out.push_back(y);
+    }
+    std::stable_sort(out.begin(), out.end(), by_region_and_value);
+    for (std::size_t k = 0; k < out.size(); k++)
+      out[k].rank = (k > 0 && out[k].region == out[k - 1].region) ? out[k - 1].rank + 1 : 1;
+    return out;
+  }
+
+private:
+  // sum of M * C over cells begin..end-1, skipping missing values
+  template <typename T>
+  POPS_MULTIVERSION static double product_sum(const T* M, const T* C, long begin, long end){
+    double total = 0;
+    #pragma omp simd reduction(+:total)
+    for (long cell = begin; cell < end; cell++){
+      double v = double(M[cell]) * double(C[cell]);
+      total += std::isnan(v) ? 0.0 : v;
+    }
+    return total;
+  }
+
+  static bool by_region_and_value(const YearRank& a, const YearRank& b){
+    if (a.region != b.region) return a.region < b.region;
+    return a.value > b.value;
+  }
+
+  std::size_t ncell_;
+  std::vector<int> zones_;
+  int nregions_;
+  std::map<int, int> weeks_;
+  std::vector<WeekTotal> weekly_;
+};
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef POPS_ENGINE_RNG_H
+#define POPS_ENGINE_RNG_H
+
+// Random numbers for the native engine.
+//
+// The engine cannot use R's generator (R::runif and friends are not thread safe
+// and cannot be called from a background thread), so it carries its own:
+// xoshiro256** seeded through splitmix64. A generator is keyed by
+// (seed, stream, substream) - e.g. (seed_n, time step, source cell) - which
+// makes every source cell draw from its own reproducible stream, independently
+// of the order or the thread in which cells are processed.
+//
+// All distributions are implemented here (not with <random>) so that a given
+// seed gives the same run on every compiler and platform.
+//
+// An antithetic generator (antithetic()) returns the complement of every raw
+// output of the same stream, so each of its uniforms is 1 - u: a replicate run
+// on antithetic streams is negatively correlated with the replicate of the same
+// seed, and the mean of such a pair varies less than that of two independent
+// replicates. Only draws by inversion, monotone in their uniform (such as
+// poisson_inversion()), keep that negative correlation; rejection samplers
+// such as poisson() do not.
+
+#include <cmath>
+#include <cstdint>
+
+namespace pops {
+
+const double pi = 3.14159265358979323846;
+
+inline uint64_t splitmix64(uint64_t& x){
+  uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// seed of an independent stream derived from 'seed' (e.g. for the children of
+// a forked simulation, see Simulation::fork)
+inline uint64_t derive_seed(uint64_t seed, uint64_t stream){
+  uint64_t x = seed ^ (stream * 0xA24BAED4963EE407ULL);
+  splitmix64(x);
+  return splitmix64(x);
+}
+
+class Rng {
+public:
+  Rng(uint64_t seed, uint64_t stream = 0, uint64_t substream = 0) : mask_(0){
+    uint64_t x = seed;
+    uint64_t h = splitmix64(x) ^ (stream * 0xD1B54A32D192ED03ULL);
+    h = splitmix64(h) ^ (substream * 0x8CB92BA72F3D8DD7ULL);
+    for (int i = 0; i < 4; i++) s_[i] = splitmix64(h);
+  }
+
+  uint64_t next(){
+    const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return result ^ mask_;
+  }
+
+  // complement the outputs from now on (see above)
+  void antithetic(){ mask_ = ~uint64_t(0); }
+
+  // uniform on the open interval (0,1)
+  double uniform(){
+    return (double(next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+  }
+
+  double uniform(double a, double b){
+    return a + (b - a) * uniform();
+  }
+
+  double exponential(double mean){
+    return -std::log(uniform()) * mean;
+  }
+
+  double cauchy(double scale){
+    return scale * std::tan(pi * (uniform() - 0.5));
+  }
+
+  double normal(){
+    // Marsaglia polar method (the second value is discarded to keep streams simple)
+    double u, v, s;
+    do {
+      u = 2.0 * uniform() - 1.0;
+      v = 2.0 * uniform() - 1.0;
+      s = u * u + v * v;
+    } while (s >= 1.0 || s == 0.0);
+    return u * std::sqrt(-2.0 * std::log(s) / s);
+  }
+
+  // trials up to and including the first success, each succeeding with probability p > 0
+  long geometric(double p){
+    if (p >= 1) return 1;
+    double t = std::ceil(std::log(uniform()) / std::log1p(-p));
+    return t < 1 ? 1 : t > 2e9 ? 2000000000L : long(t);
+  }
+
+  int poisson(double mean){
+    if (!(mean > 0)) return 0;
+    if (mean < 10){
+      // multiplication method
+      double L = std::exp(-mean);
+      double p = 1.0;
+      int k = 0;
+      do {
+        k++;
+        p *= uniform();
+      } while (p > L);
+      return k - 1;
+    }
+    // transformed rejection with squeeze (Hormann 1993, PTRS)
+    double slam = std::sqrt(mean);
+    double loglam = std::log(mean);
+    double b = 0.931 + 2.53 * slam;
+    double a = -0.059 + 0.02483 * b;
+    double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+    double vr = 0.9277 - 3.6224 / (b - 2);
+    while (true){
+      double U = uniform() - 0.5;
+      double V = uniform();
+      double us = 0.5 - std::fabs(U);
+      double k = std::floor((2 * a / us + b) * U + mean + 0.43);
+      if (us >= 0.07 && V <= vr) return int(k);
+      if (k < 0 || (us < 0.013 && V > us)) continue;
+      if (std::log(V) + std::log(invalpha) - std::log(a / (us * us) + b) <=
+          -mean + k * loglam - std::lgamma(k + 1))
+        return int(k);
+    }
+  }
+
+  // Poisson draw from a single uniform by inversion of the distribution
+  // function: the count is nondecreasing in the mean for a given uniform, so
+  // draws of one stream under different means are coupled (and antithetic
+  // streams give negatively correlated counts). The search starts at the mode
+  // and walks towards the uniform, about sqrt(mean) terms for large means.
+  int poisson_inversion(double mean){
+    if (!(mean > 0)) return 0;
+    double u = uniform();
+    int mode = int(std::floor(mean));
+    double p_mode = std::exp(-mean + mode * std::log(mean) - std::lgamma(mode + 1.0));
+    // distribution function at the mode, summing the terms below it until they vanish
+    double cdf = p_mode, p = p_mode;
+    for (int k = mode; k > 0; k--){
+      p *= k / mean;
+      cdf += p;
+      if (p < cdf * 1e-17) break;
+    }
+    int k = mode;
+    p = p_mode;
+    if (u <= cdf){
+      // smallest k with F(k) >= u: walk down while F(k - 1) still reaches u
+      while (k > 0 && u <= cdf - p){
+        cdf -= p;
+        p *= k / mean;
+        k--;
+      }
+      return k;
+    }
+    while (cdf < u){
+      k++;
+      p *= mean / k;
+      if (p < cdf * 1e-17) break;   // u beyond the precision of the distribution function
+      cdf += p;
+    }
+    return k;
+  }
+
+  // von Mises angle with mean direction mu and concentration kappa (see VonMises)
+  double von_mises(double mu, double kappa);
+
+private:
+  static uint64_t rotl(uint64_t x, int k){
+    return (x << k) | (x >> (64 - k));
+  }
+  uint64_t s_[4];
+  uint64_t mask_;     // 0, or all ones for an antithetic stream
+};
+
+// von Mises angles with mean direction mu and concentration kappa (Best &
+// Fisher 1979); the constants of the sampler are computed once, so a sampler
+// can be set up per cell and step and reused for all the spores of the cell
+class VonMises {
+public:
+  VonMises() : mu_(0), kappa_(0), r_(0) {}
+  VonMises(double mu, double kappa) : mu_(mu), kappa_(kappa), r_(0){
+    if (kappa_ < 1e-8) return;
+    double tau = 1 + std::sqrt(1 + 4 * kappa_ * kappa_);
+    double rho = (tau - std::sqrt(2 * tau)) / (2 * kappa_);
+    r_ = (1 + rho * rho) / (2 * rho);
+  }
+
+  double sample(Rng& rng) const {
+    if (kappa_ < 1e-8) return rng.uniform(-pi, pi);
+    double f;
+    while (true){
+      double z = std::cos(pi * rng.uniform());
+      f = (1 + r_ * z) / (r_ + z);
+      double c = kappa_ * (r_ - f);
+      double u2 = rng.uniform();
+      if (c * (2 - c) - u2 > 0 || std::log(c / u2) + 1 - c >= 0) break;
+    }
+    double theta = mu_ + (rng.uniform() > 0.5 ? 1 : -1) * std::acos(f);
+    return std::remainder(theta, 2 * pi);
+  }
+
+private:
+  double mu_, kappa_, r_;
+};
+
+inline double Rng::von_mises(double mu, double kappa){
+  return VonMises(mu, kappa).sample(*this);
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef POPS_ENGINE_SCHEDULE_H
+#define POPS_ENGINE_SCHEDULE_H
+
+// Precomputed schedule of simulation steps.
+//
+// The simulation clock starts on January 1st of the start year and advances by
+// days, weeks or months until December 31st of the end year (the same series
+// as seq(dd_start, dd_end, time_step) in pest()). Step k (1-based) uses weather
+// layer k. Only steps on which something happens are kept:
+//  - active:    spread happens (month within s1..s2 when seasonality is on)
+//  - mortality: first step on or after the mortality date of each year
+//  - output:    last step falling in the output month of each year
+// so the driver can jump directly from one event to the next and read only the
+// weather layers of active steps.
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace pops {
+
+struct Date {
+  int year;
+  int month;
+  int day;
+};
+
+// days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's algorithm)
+inline long days_from_civil(int y, int m, int d){
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+inline Date civil_from_days(long z){
+  z += 719468;
+  long era = (z >= 0 ? z : z - 146096) / 146097;
+  long doe = z - era * 146097;
+  long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  long mp = (5 * doy + 2) / 153;
+  Date out;
+  out.day = int(doy - (153 * mp + 2) / 5 + 1);
+  out.month = int(mp < 10 ? mp + 3 : mp - 9);
+  out.year = int(yoe + era * 400 + (out.month <= 2));
+  return out;
+}
+
+inline std::string format_date(const Date& d){
+  char buf[16];
+  std::snprintf(buf, sizeof(buf), "%04d-%02d-%02d", d.year, d.month, d.day);
+  return buf;
+}
+
+enum StepUnit { STEP_DAY, STEP_WEEK, STEP_MONTH };
+
+inline StepUnit step_unit(const std::string& time_step){
+  if (time_step == "days" || time_step == "day" || time_step == "daily") return STEP_DAY;
+  if (time_step == "weeks" || time_step == "week" || time_step == "weekly") return STEP_WEEK;
+  if (time_step == "months" || time_step == "month" || time_step == "monthly") return STEP_MONTH;
+  throw std::invalid_argument("time_step must be one of 'days', 'weeks' or 'months'");
+}
+
+struct ScheduleOptions {
+  int start_year;
+  int end_year;
+  StepUnit unit;
+  bool seasonality;
+  int s1, s2;             // first and last spread month (1-12)
+  int output_month;       // yearly output on the last step of this month
+  bool mortality;
+  int mortality_month;    // yearly mortality on the first step on/after this date
+  int mortality_day;
+};
+
+struct ScheduledStep {
+  int step;               // 1-based step (and weather layer) number
+  Date date;
+  bool active;
+  bool mortality;
+  bool output;
+};
+
+class Schedule {
+public:
+  explicit Schedule(const ScheduleOptions& opt) : n_steps_(0), start_year_(opt.start_year), unit_(opt.unit){
+    if (opt.start_year > opt.end_year) throw std::invalid_argument("start date must precede end date");
+    int m_lo = std::min(opt.s1, opt.s2);
+    int m_hi = std::max(opt.s1, opt.s2);
+
+    long last = days_from_civil(opt.end_year, 12, 31);
+    std::vector<Date> dates;
+    for (long k = 0; ; k++){
+      Date d;
+      if (opt.unit == STEP_MONTH){
+        long m = k;   // months since January of the start year
+        d.year = opt.start_year + int(m / 12);
+        d.month = int(m % 12) + 1;
+        d.day = 1;
+        if (days_from_civil(d.year, d.month, d.day) > last) break;
+      }else{
+        long z = days_from_civil(opt.start_year, 1, 1) + k * (opt.unit == STEP_WEEK ? 7 : 1);
+        if (z > last) break;
+        d = civil_from_days(z);
+      }
+      dates.push_back(d);
+    }
+    n_steps_ = int(dates.size());
+
+    int mortality_year = opt.start_year - 1;
+    for (int k = 0; k < n_steps_; k++){
+      const Date& d = dates[k];
+      ScheduledStep s;
+      s.step = k + 1;
+      s.date = d;
+      s.active = !opt.seasonality || (d.month >= m_lo && d.month <= m_hi);
+      s.mortality = false;
+      if (opt.mortality && d.year > mortality_year &&
+          (d.month > opt.mortality_month || (d.month == opt.mortality_month && d.day >= opt.mortality_day))){
+        s.mortality = true;
+        mortality_year = d.year;
+      }
+      s.output = d.month == opt.output_month &&
+        (k + 1 == n_steps_ || dates[k + 1].month != opt.output_month || dates[k + 1].year != d.year);
+      if (s.active || s.mortality || s.output) events_.push_back(s);
+    }
+  }
+
+  // number of steps on the full clock (= layers expected in the weather data)
+  int n_steps() const { return n_steps_; }
+  // steps with at least one event, in time order
+  const std::vector<ScheduledStep>& events() const { return events_; }
+
+  // first step on or after a date (n_steps + 1 past the end of the clock)
+  int step_at(const Date& d) const {
+    long step;
+    if (unit_ == STEP_MONTH){
+      step = long(d.year - start_year_) * 12 + d.month + (d.day > 1 ? 1 : 0);
+    }else{
+      long len = unit_ == STEP_WEEK ? 7 : 1;
+      long z = days_from_civil(d.year, d.month, d.day) - days_from_civil(start_year_, 1, 1);
+      step = z <= 0 ? 1 : (z + len - 1) / len + 1;
+    }
+    return int(std::max(1L, std::min(step, long(n_steps_) + 1)));
+  }
+
+  // the events of steps first..last only; the clock is unchanged, so steps
+  // (and weather layers) keep their numbers
+  Schedule slice(int first, int last) const {
+    Schedule part(*this);
+    part.events_.clear();
+    for (std::size_t k = 0; k < events_.size(); k++)
+      if (events_[k].step >= first && events_[k].step <= last) part.events_.push_back(events_[k]);
+    return part;
+  }
+
+private:
+  int n_steps_;
+  int start_year_;
+  StepUnit unit_;
+  std::vector<ScheduledStep> events_;
+};
+
+} // namespace pops
+
+#endif
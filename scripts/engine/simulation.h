@@ -0,0 +1,870 @@
+#ifndef POPS_ENGINE_SIMULATION_H
+#define POPS_ENGINE_SIMULATION_H
+
+// Native simulation engine: host state, spore generation and dispersal,
+// cold mortality and the driver walking the step schedule.
+//
+// It follows the model of pest() + SporeGenCpp + SporeDispCpp_mh:
+//  - every infected cell produces Poisson(n * sporeRate * weather) spores,
+//    n being the host_score-weighted number of infected hosts in the cell;
+//  - each spore travels a kernel distance in a uniform (or von Mises, with
+//    wind) direction;
+//  - a spore staying in its source cell challenges all susceptible hosts, a
+//    spore landing elsewhere challenges hosts weighted by host_score; it
+//    infects with probability (challenged susceptibles / N_LVE) * weather and
+//    the infected host is picked in proportion to the challenged susceptibles.
+//
+// A step runs in two phases. All infected cells first generate their spores
+// from the state at the start of the step (as SporeGenCpp does for the whole
+// grid) and turn them into landings; the landings are then resolved in order
+// of (source cell, spore). The random numbers a landing needs are drawn at the
+// source and travel with it, so the outcome does not depend on where, or in
+// which process, a landing is resolved. This is what allows a domain to be
+// split in row strips (see decomposition.h) with results identical to a
+// single-process run.
+//
+// In very dense outbreaks the sequential second phase dominates. With
+// SpreadParams::concurrent_landing the landings are instead resolved by
+// several threads updating the host grids directly: a thread decides the
+// infection and the host on the susceptible counts it read, and removes the
+// susceptible with a compare-and-swap, deciding again on the new counts if
+// another thread changed the cell in between. Susceptibles never go negative
+// and no lock or merge is needed, but the order in which landings on the same
+// cell are resolved then depends on the threads, so such runs are not
+// reproducible.
+//
+// With SpreadParams::aggregate_landings the landings are instead counted per
+// destination cell (spores from the cell itself and from elsewhere apart, as
+// they challenge the hosts differently) and the spores of a cell are resolved
+// together on a random stream of the cell: the spores up to the next
+// infection are one geometric draw and the infected host one draw, against the
+// counts left by the previous infections. The outcome has the distribution of
+// the spore by spore resolution (the spores of the cell itself first) with a
+// few draws per infection instead of two per spore, and depends only on the
+// counts, so it is still the same for any split in strips or threads.
+//
+// Grids are stored row-major (cell = row * ncol + col). A Simulation may own
+// only a strip of rows of the study area: cell indices exchanged with other
+// strips (Landing) are global, grids and infected cell lists are local. The
+// engine does not use any R API, so it can run on a worker thread or outside R.
+//
+// Calibration compares parameter sets run on the same seeds. By default a cell
+// draws its spore count and then all its spores from one stream, so a change
+// of spore rate shifts every later draw of the cell. With
+// SpreadParams::common_random_numbers the spore count of a cell is drawn from
+// one uniform by inversion, so it moves with the spore rate and the weather
+// instead of jumping to an unrelated value, and each spore takes its own
+// stream, keyed by step, source cell and spore number, so spore k of a cell
+// travels and lands the same way under every parameter set where the cell has
+// a spore k. Runs of
+// two parameter sets then differ through the parameters rather than through
+// the noise, which makes their comparison need far fewer replicates.
+// SpreadParams::antithetic runs the replicate on the complement of every
+// stream (see rng.h), giving antithetic pairs with the plain replicate.
+//
+// The driver reads the weather of a step only in its active window (see
+// window.h): the window of the infected cells grown by the reach of the kernel,
+// and beyond it the cells with hosts that spores reached. The union of these
+// windows over the run (touched_window()) tells how much of the study area the
+// run actually used.
+//
+// A simulation can be forked at any point between two steps (fork()): the
+// children share the host grids (and the infected cell flags) of their parent
+// and copy a grid only when they first write to it, so scenarios sharing a historical period simulate it once.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "kernel.h"
+#include "kernel_table.h"
+#include "mortality.h"
+#include "rng.h"
+#include "schedule.h"
+#include "window.h"
+#include "work_stealing.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace pops {
+
+// a spore that landed inside the study area; cells are global indices
+struct Landing {
+  int dest;
+  int source;
+  int seq;              // spore number within the source cell
+  double u_infect;      // uniform draw deciding the infection
+  double u_pick;        // uniform draw picking the infected host
+};
+
+// Wind of a step, one value per cell of the grid: direction the spores are
+// blown to (degrees clockwise from north, as windDir) and von Mises
+// concentration (NULL = kappa of the kernel). A missing direction (NaN) or a
+// concentration of 0 leaves the direction uniform in the cell. Without a field
+// the wind of the kernel applies everywhere.
+struct WindField {
+  const float* direction;
+  const float* kappa;
+  WindField() : direction(0), kappa(0) {}
+  WindField(const float* direction, const float* kappa) : direction(direction), kappa(kappa) {}
+};
+
+struct SpreadParams {
+  double res;           // cell size (map units, same as the kernel scale)
+  double spore_rate;    // spores per infected host per step
+  Kernel kernel;
+  uint64_t seed;
+  std::shared_ptr<const KernelTable> table;   // discretized kernel (see kernel_table.h), NULL = sample the kernel
+  int threads;          // threads dispersing the spores of a step (see disperse())
+  bool concurrent_landing;   // with threads > 1, resolve the landings on all threads (see land())
+  bool aggregate_landings;   // resolve the landings per destination cell (see land())
+  bool common_random_numbers;   // a random stream per spore (see disperse())
+  bool antithetic;              // antithetic streams (see rng.h)
+
+  SpreadParams() : res(1), spore_rate(0), seed(0), threads(1), concurrent_landing(false), aggregate_landings(false),
+                   common_random_numbers(false), antithetic(false) {}
+};
+
+// spores of a source cell are dispersed in batches of this many; the batches
+// are the tasks shared among the threads, so a dense cell is spread over
+// several threads
+const int SPORE_BATCH = 256;
+
+// Copy-on-write grid: copies of a SharedArray share one buffer until one of them
+// is written to. write() must not race with copying the same SharedArray (fork a
+// simulation only between two steps); copies held by other threads are fine.
+template <typename T>
+class SharedArray {
+public:
+  SharedArray() : data_(std::make_shared<std::vector<T> >()) {}
+  SharedArray(const std::vector<T>& values) : data_(std::make_shared<std::vector<T> >(values)) {}
+
+  const std::vector<T>& get() const { return *data_; }
+  const T& operator[](std::size_t cell) const { return (*data_)[cell]; }
+  std::size_t size() const { return data_->size(); }
+  bool shared() const { return data_.use_count() > 1; }
+
+  // the grid for writing, copied first if other simulations still use it
+  std::vector<T>& write(){
+    if (data_.use_count() > 1) data_ = std::make_shared<std::vector<T> >(*data_);
+    // the last other user may have released the grid on another thread
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return *data_;
+  }
+
+private:
+  std::shared_ptr<std::vector<T> > data_;
+};
+
+typedef SharedArray<int> SharedGrid;
+
+class Simulation {
+public:
+  Simulation(int nrow, int ncol,
+             const std::vector<std::vector<int> >& S, const std::vector<std::vector<int> >& I,
+             const std::vector<int>& total_hosts, const std::vector<double>& host_score,
+             const std::vector<double>& lethal_temp, const SpreadParams& params,
+             int row_begin = 0, int global_nrow = -1)
+    : nrow_(nrow), ncol_(ncol), row_begin_(row_begin), global_nrow_(global_nrow < 0 ? nrow : global_nrow),
+      S_(S.begin(), S.end()), I_(I.begin(), I.end()), N_(total_hosts), score_(host_score), lethal_temp_(lethal_temp),
+      params_(params){
+    std::size_t ncell = std::size_t(nrow) * ncol;
+    if (S_.empty() || S_.size() != I_.size()) throw std::invalid_argument("S and I must be given for every host");
+    if (score_.size() != S_.size()) throw std::invalid_argument("a host score must be given for every host");
+    if (N_.size() != ncell) throw std::invalid_argument("total hosts grid does not match the host grids");
+    for (std::size_t h = 0; h < S_.size(); h++)
+      if (S_[h].size() != ncell || I_[h].size() != ncell) throw std::invalid_argument("host grids must all have the same dimensions");
+    if (row_begin_ < 0 || row_begin_ + nrow_ > global_nrow_) throw std::invalid_argument("rows of the strip are outside of the study area");
+    if (lethal_temp_.empty()) lethal_temp_.push_back(NAN);
+    params_.kernel.validate();
+    if (params_.table && params_.table->res() != params_.res) throw std::invalid_argument("the kernel table was built for another cell size");
+    // same radius as the discretized kernel
+    double reach = params_.table ? params_.table->reach() : std::min(params_.kernel.quantile(1 - 1e-5), 256 * params_.res);
+    reach_ = int(std::ceil(reach / params_.res + 0.5));
+    recount();
+  }
+
+  int nrow() const { return nrow_; }
+  int ncol() const { return ncol_; }
+  int ncell() const { return nrow_ * ncol_; }
+  int nhosts() const { return int(S_.size()); }
+  // first global row of the strip and number of rows of the whole study area
+  int row_begin() const { return row_begin_; }
+  int global_nrow() const { return global_nrow_; }
+  const SpreadParams& params() const { return params_; }
+  const std::vector<double>& host_score() const { return score_; }
+  const std::vector<double>& lethal_temp() const { return lethal_temp_; }
+
+  const std::vector<int>& susceptible(int h) const { return S_[h].get(); }
+  const std::vector<int>& infected(int h) const { return I_[h].get(); }
+  const std::vector<int>& total_hosts() const { return N_.get(); }
+  // cells holding infected hosts (unordered)
+  const std::vector<int>& infected_cells() const { return infected_; }
+
+  // bounding window (global rows) of the cells of the strip holding infected hosts
+  const Window& infected_window() const { return infected_window_; }
+  // reach of the kernel in cells (radius of the discretized kernel)
+  int reach() const { return reach_; }
+  // infected window grown by the reach: where the spores of a step mostly land
+  Window active_window() const { return infected_window_.expanded(reach_, global_nrow_, ncol_); }
+  // window of the landings falling in the strip on cells with susceptible
+  // hosts, the only landings reading the weather
+  Window landing_window(const std::vector<Landing>& landings) const {
+    int offset = row_begin_ * ncol_;
+    int end = offset + ncell();
+    Window w;
+    for (std::size_t k = 0; k < landings.size(); k++){
+      int dest = landings[k].dest;
+      if (dest < offset || dest >= end || cells_[dest - offset].susceptible <= 0) continue;
+      w.include(dest / ncol_, dest % ncol_);
+    }
+    return w;
+  }
+  // union of the windows the weather was read in (see spread())
+  const Window& touched_window() const { return touched_; }
+  void touch(const Window& window){ touched_.include(window); }
+
+  long infected_total(int h) const { return infected_total_[h]; }
+  long susceptible_total() const { return susceptible_total_; }
+
+  // number of cells where host h is infected
+  long infected_area(int h) const {
+    long n = 0;
+    for (std::size_t k = 0; k < infected_.size(); k++)
+      if (I_[h][infected_[k]] > 0) n++;
+    return n;
+  }
+
+  // Child simulation continuing from the current state. The host grids are
+  // shared with this simulation until either writes to them. Stream 0 keeps
+  // the random stream of this simulation (the child then reproduces an
+  // unforked run); every other stream gives the child its own random numbers.
+  Simulation fork(uint64_t stream) const {
+    Simulation child(*this);
+    if (stream != 0) child.params_.seed = derive_seed(params_.seed, stream);
+    return child;
+  }
+
+  // one spread step over a simulation owning the whole study area.
+  // weather is the suitability grid of the step (NULL = 1 everywhere), wind
+  // the wind field of the step (none = the wind of the kernel)
+  void spread(int step, const float* weather, const WindField& wind = WindField()){
+    std::vector<Landing> landings;
+    disperse(step, weather, landings, wind);
+    land(step, landings, weather);
+  }
+
+  // first phase of a step: spores of every infected cell of the strip, appended
+  // to 'landings' in order of (source cell, spore). Spores leaving the study area
+  // are dropped.
+  //
+  // The spores of a cell are drawn in batches of SPORE_BATCH: the first batch
+  // continues the random stream of the cell, batch b > 0 has a stream of its
+  // own, so a batch can be dispersed on any thread. With several threads the
+  // batches are shared by work stealing weighted by their spores (see
+  // work_stealing.h) and the landings are put back in (source cell, spore)
+  // order, so the result does not depend on the number of threads.
+  void disperse(int step, const float* weather, std::vector<Landing>& landings,
+                const WindField& wind = WindField()){
+    // the state is not changed before land(), so every cell generates spores
+    // from the state at the start of the step
+    std::sort(infected_.begin(), infected_.end());
+    int offset = row_begin_ * ncol_;
+    long ncells = long(infected_.size());
+    int threads = std::max(1, params_.threads);
+
+    // spores of every cell, and the stream of its first batch
+    std::vector<int> spores(ncells);
+    std::vector<Rng> rngs(ncells, Rng(0));
+    #pragma omp parallel for num_threads(threads) schedule(static) if (threads > 1 && ncells > 1024)
+    for (long k = 0; k < ncells; k++){
+      int cell = infected_[k];
+      rngs[k] = stream(params_.seed, uint64_t(step), uint64_t(offset + cell));
+      spores[k] = generate(cell, weather, rngs[k]);
+    }
+
+    // tasks: (cell, batch) in (source cell, spore) order
+    std::vector<SporeBatch> tasks;
+    std::vector<long> weights;
+    long total = 0;
+    for (long k = 0; k < ncells; k++)
+      for (int first = 0; first < spores[k]; first += SPORE_BATCH){
+        SporeBatch t = {int(k), first, std::min(SPORE_BATCH, spores[k] - first)};
+        tasks.push_back(t);
+        weights.push_back(t.count);
+        total += t.count;
+      }
+
+    if (threads == 1 || total < 4 * SPORE_BATCH){
+      for (std::size_t t = 0; t < tasks.size(); t++)
+        disperse_batch(step, tasks[t], rngs[tasks[t].cell], wind, landings);
+      return;
+    }
+
+    // per thread: landings of the tasks it ran; per task: thread, first landing and count
+    StealingQueue queue(weights, threads);
+    std::vector<std::vector<Landing> > out(threads);
+    std::vector<int> task_thread(tasks.size());
+    std::vector<std::size_t> task_begin(tasks.size()), task_count(tasks.size());
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+      int self = omp_get_thread_num();
+#else
+      int self = 0;
+#endif
+      std::vector<Landing>& mine = out[self];
+      std::size_t t;
+      while (queue.next(self, t)){
+        std::size_t before = mine.size();
+        disperse_batch(step, tasks[t], rngs[tasks[t].cell], wind, mine);
+        task_thread[t] = self;
+        task_begin[t] = before;
+        task_count[t] = mine.size() - before;
+      }
+    }
+    std::size_t at = landings.size(), n = 0;
+    for (std::size_t t = 0; t < tasks.size(); t++) n += task_count[t];
+    landings.resize(at + n);
+    for (std::size_t t = 0; t < tasks.size(); t++){
+      const std::vector<Landing>& from = out[task_thread[t]];
+      std::copy(from.begin() + task_begin[t], from.begin() + task_begin[t] + task_count[t], landings.begin() + at);
+      at += task_count[t];
+    }
+  }
+
+  // second phase of a step: resolve the landings falling in the strip, in the
+  // order given (which must be the order of (source cell, spore)), or per
+  // destination cell with SpreadParams::aggregate_landings, or concurrently
+  // with SpreadParams::concurrent_landing
+  void land(int step, const std::vector<Landing>& landings, const float* weather){
+    if (params_.aggregate_landings){
+      land_aggregated(step, landings, weather);
+      return;
+    }
+    if (params_.concurrent_landing && params_.threads > 1){
+      land_concurrent(landings, weather, params_.threads);
+      return;
+    }
+    int offset = row_begin_ * ncol_;
+    int end = offset + ncell();
+    for (std::size_t k = 0; k < landings.size(); k++){
+      const Landing& l = landings[k];
+      if (l.dest < offset || l.dest >= end) continue;
+      challenge(l.dest - offset, l.dest == l.source, weather, l);
+    }
+  }
+
+  // copy the state of a strip (same study area) into this simulation
+  void assign_rows(const Simulation& part){
+    std::size_t offset = std::size_t(part.row_begin() - row_begin_) * ncol_;
+    for (std::size_t h = 0; h < S_.size(); h++){
+      const std::vector<int>& S = part.susceptible(int(h));
+      const std::vector<int>& I = part.infected(int(h));
+      std::copy(S.begin(), S.end(), S_[h].write().begin() + offset);
+      std::copy(I.begin(), I.end(), I_[h].write().begin() + offset);
+    }
+    recount();
+  }
+
+  // yearly cold mortality (see mortality.h)
+  template <typename T>
+  void mortality(const T* crit_temp){
+    std::vector<HostGrids> hosts;
+    for (std::size_t h = 0; h < S_.size(); h++){
+      HostGrids g = {&S_[h].write()[0], &I_[h].write()[0], lethal_temp_[h % lethal_temp_.size()]};
+      hosts.push_back(g);
+    }
+    std::vector<long> removed;
+    std::vector<int> before(infected_);
+    std::vector<char>& is_infected = is_infected_.write();
+    for (std::size_t k = 0; k < infected_.size(); k++) is_infected[infected_[k]] = 0;
+    cold_mortality(hosts, crit_temp, infected_, removed);
+    for (std::size_t k = 0; k < infected_.size(); k++) is_infected[infected_[k]] = 1;
+    for (std::size_t k = 0; k < before.size(); k++) refresh(before[k]);
+    infected_window_ = Window();
+    for (std::size_t k = 0; k < infected_.size(); k++) include(infected_[k]);
+    for (std::size_t h = 0; h < removed.size(); h++){
+      infected_total_[h] -= removed[h];
+      susceptible_total_ += removed[h];
+    }
+  }
+
+private:
+  // Susceptible hosts of a cell as a spore challenges them: all hosts (spores
+  // staying in their cell), weighted by host_score (spores from elsewhere),
+  // and 1 / total hosts (N_LVE). Cached per cell and recomputed from the grids
+  // whenever an infection or mortality changes the cell, so the infection test
+  // of a spore is a few loads instead of a pass over every host grid.
+  struct CellHosts {
+    int susceptible;
+    double weighted;
+    double inv_total;     // 0 for cells without hosts
+  };
+
+  // infected cell list and totals from the grids
+  void recount(){
+    std::size_t ncell = S_[0].size();
+    infected_.clear();
+    infected_total_.assign(S_.size(), 0);
+    susceptible_total_ = 0;
+    std::vector<char> is_infected(ncell, 0);
+    for (std::size_t cell = 0; cell < ncell; cell++){
+      for (std::size_t h = 0; h < S_.size(); h++){
+        susceptible_total_ += S_[h][cell];
+        infected_total_[h] += I_[h][cell];
+        if (I_[h][cell] > 0 && !is_infected[cell]){
+          is_infected[cell] = 1;
+          infected_.push_back(int(cell));
+        }
+      }
+    }
+    is_infected_ = SharedArray<char>(is_infected);
+    std::vector<CellHosts> cells(ncell);
+    for (std::size_t cell = 0; cell < ncell; cell++) cells[cell] = aggregate(int(cell));
+    cells_ = SharedArray<CellHosts>(cells);
+    infected_window_ = Window();
+    for (std::size_t k = 0; k < infected_.size(); k++) include(infected_[k]);
+  }
+
+  // grow the infected window to a (local) cell
+  void include(int cell){
+    infected_window_.include(row_begin_ + cell / ncol_, cell % ncol_);
+  }
+
+  // aggregates of the hosts of a cell, from the grids
+  CellHosts aggregate(int cell) const {
+    CellHosts c;
+    c.susceptible = 0;
+    c.weighted = 0;
+    for (std::size_t h = 0; h < S_.size(); h++){
+      c.susceptible += S_[h][cell];
+      c.weighted += S_[h][cell] * score_[h];
+    }
+    c.inv_total = N_[cell] > 0 ? 1.0 / N_[cell] : 0;
+    return c;
+  }
+
+  // the cached aggregates of a cell after its hosts changed
+  void refresh(int cell){
+    cells_.write()[cell] = aggregate(cell);
+  }
+
+  // spores first..first+count-1 of the k-th infected cell (infected_ sorted)
+  struct SporeBatch {
+    int cell;
+    int first, count;
+  };
+
+  // landings of one batch of spores; 'cell_rng' is the stream of the cell
+  // after its spores were generated, used as is by the first batch. With
+  // common random numbers every spore has a stream of its own instead.
+  void disperse_batch(int step, const SporeBatch& batch, const Rng& cell_rng, const WindField& wind,
+                      std::vector<Landing>& landings) const {
+    int offset = row_begin_ * ncol_;
+    int cell = infected_[batch.cell];
+    const Kernel& kernel = params_.kernel;
+    // direction sampler: the wind of the kernel, or that of the cell with a field
+    // (set up once per batch rather than per spore)
+    VonMises blown(kernel.wind_dir, kernel.wind ? kernel.kappa : 0);
+    if (wind.direction){
+      double dir = wind.direction[cell];
+      double kappa = wind.kappa ? wind.kappa[cell] : kernel.kappa;
+      blown = VonMises(dir * pi / 180, std::isnan(dir) || !(kappa > 0) ? 0 : kappa);
+    }
+    Landing l;
+    if (params_.common_random_numbers){
+      uint64_t seed = derive_seed(params_.seed ^ 0x434F4D4D4F4E5350ULL, 0);
+      for (int sp = batch.first; sp < batch.first + batch.count; sp++){
+        Rng rng = stream(seed, uint64_t(step), uint64_t(offset + cell) << 32 | uint64_t(sp));
+        if (disperse_spore(cell, sp, rng, blown, wind, l)) landings.push_back(l);
+      }
+      return;
+    }
+    Rng rng = batch.first == 0 ? cell_rng
+      : stream(derive_seed(params_.seed ^ 0x53504F5245424154ULL, uint64_t(batch.first / SPORE_BATCH)), uint64_t(step), uint64_t(offset + cell));
+    for (int sp = batch.first; sp < batch.first + batch.count; sp++)
+      if (disperse_spore(cell, sp, rng, blown, wind, l)) landings.push_back(l);
+  }
+
+  // landing of spore 'sp' of a (local) cell; false if it left the study area
+  bool disperse_spore(int cell, int sp, Rng& rng, const VonMises& blown, const WindField& wind, Landing& l) const {
+    int row = row_begin_ + cell / ncol_;
+    int col = cell % ncol_;
+    double row0, col0;
+    if (params_.table && !wind.direction){
+      // the table holds the direction of the kernel's own wind only
+      int drow, dcol;
+      params_.table->sample(rng, drow, dcol);
+      row0 = double(row) + drow;
+      col0 = double(col) + dcol;
+    }else{
+      double dist = params_.kernel.distance(rng);
+      double theta = blown.sample(rng);
+      row0 = row - std::floor(dist * std::cos(theta) / params_.res + 0.5);
+      col0 = col + std::floor(dist * std::sin(theta) / params_.res + 0.5);
+    }
+    // aggregated landings draw on the stream of their destination instead
+    l.u_infect = params_.aggregate_landings ? 0 : rng.uniform();
+    l.u_pick = params_.aggregate_landings ? 0 : rng.uniform();
+    if (row0 < 0 || row0 >= global_nrow_) return false;     //outside of the study area
+    if (col0 < 0 || col0 >= ncol_) return false;            //outside of the study area
+    l.dest = int(row0) * ncol_ + int(col0);
+    l.source = row_begin_ * ncol_ + cell;
+    l.seq = sp;
+    return true;
+  }
+
+  // random stream of the simulation, antithetic with SpreadParams::antithetic
+  Rng stream(uint64_t seed, uint64_t stream, uint64_t substream) const {
+    Rng rng(seed, stream, substream);
+    if (params_.antithetic) rng.antithetic();
+    return rng;
+  }
+
+  // number of spores produced by an infected cell
+  int generate(int cell, const float* weather, Rng& rng) const {
+    double w = weather ? weather[cell] : 1.0;
+    if (!(w > 0)) return 0;
+    double weighted = 0;
+    for (std::size_t h = 0; h < I_.size(); h++)
+      weighted += I_[h][cell] * score_[h];
+    int n = int(weighted);   // same truncation as the IntegerMatrix conversion in SporeGenCpp
+    if (n <= 0) return 0;
+    // with common random numbers the count is an inversion of one uniform of
+    // the cell, so it grows with the spore rate and the weather (see rng.h)
+    if (params_.common_random_numbers) return rng.poisson_inversion(n * params_.spore_rate * w);
+    return rng.poisson(n * params_.spore_rate * w);
+  }
+
+  // a spore landing in 'dest' challenges the susceptible hosts of the cell
+  void challenge(int dest, bool same_cell, const float* weather, const Landing& l){
+    // the test only needs the cached aggregates of the cell (see CellHosts)
+    const CellHosts& c = cells_[dest];
+    double challenged = same_cell ? double(c.susceptible) : c.weighted;
+    if (!(challenged > 0)) return;
+    double w = weather ? weather[dest] : 1.0;
+    double prob = challenged * c.inv_total * w;
+    if (l.u_infect >= prob) return;
+
+    // pick the infected host in proportion to the challenged susceptibles
+    double pick = l.u_pick * challenged;
+    std::size_t h = 0;
+    for (; h + 1 < S_.size(); h++){
+      pick -= S_[h][dest] * (same_cell ? 1.0 : score_[h]);
+      if (pick < 0) break;
+    }
+    while (S_[h][dest] <= 0 && h > 0) h--;   // guard against rounding at the upper end
+    infect(int(h), dest);
+  }
+
+  // land() per destination cell: landings counted by (cell, from elsewhere),
+  // then the spores of each cell resolved together on its own stream
+  void land_aggregated(int step, const std::vector<Landing>& landings, const float* weather){
+    int offset = row_begin_ * ncol_;
+    int end = offset + ncell();
+    std::vector<int>& hits = hits_.values;   // same-cell and remote spores of cell c at 2c and 2c + 1
+    if (hits.empty()) hits.assign(std::size_t(ncell()) * 2, 0);
+    std::vector<int> touched;
+    for (std::size_t k = 0; k < landings.size(); k++){
+      const Landing& l = landings[k];
+      if (l.dest < offset || l.dest >= end) continue;
+      int cell = l.dest - offset;
+      if (hits[2 * cell] == 0 && hits[2 * cell + 1] == 0) touched.push_back(cell);
+      hits[2 * cell + (l.dest == l.source ? 0 : 1)]++;
+    }
+    // the cells do not interact within a step, so their order does not matter
+    uint64_t seed = derive_seed(params_.seed ^ 0x4C414E44494E4753ULL, uint64_t(step));
+    for (std::size_t k = 0; k < touched.size(); k++){
+      int cell = touched[k];
+      Rng rng = stream(seed, uint64_t(step), uint64_t(offset + cell));
+      resolve(cell, true, hits[2 * cell], weather, rng);
+      resolve(cell, false, hits[2 * cell + 1], weather, rng);
+      hits[2 * cell] = hits[2 * cell + 1] = 0;
+    }
+  }
+
+  // 'spores' spores landing in 'cell' in a row: after each infection the
+  // chance of the next one is that of challenge() on the counts left
+  void resolve(int cell, bool same_cell, long spores, const float* weather, Rng& rng){
+    double w = weather ? weather[cell] : 1.0;
+    while (spores > 0){
+      const CellHosts& c = cells_[cell];
+      double challenged = same_cell ? double(c.susceptible) : c.weighted;
+      if (!(challenged > 0)) return;
+      double prob = challenged * c.inv_total * w;
+      if (!(prob > 0)) return;
+      long trials = rng.geometric(prob);
+      if (trials > spores) return;
+      spores -= trials;
+      double pick = rng.uniform() * challenged;
+      std::size_t h = 0;
+      for (; h + 1 < S_.size(); h++){
+        pick -= S_[h][cell] * (same_cell ? 1.0 : score_[h]);
+        if (pick < 0) break;
+      }
+      while (S_[h][cell] <= 0 && h > 0) h--;
+      if (S_[h][cell] <= 0) return;
+      infect(int(h), cell);
+    }
+  }
+
+  // land() on several threads: each landing is resolved by challenge_concurrent()
+  // directly on the grids; new infected cells and totals are kept per thread
+  // and merged at the end (atomics of GCC and Clang, the compilers of R, on
+  // the plain int grids)
+  void land_concurrent(const std::vector<Landing>& landings, const float* weather, int threads){
+    int offset = row_begin_ * ncol_;
+    int end = offset + ncell();
+    std::size_t nhosts = S_.size();
+    // grids copied (if shared) before the threads start
+    std::vector<int*> S(nhosts), I(nhosts);
+    for (std::size_t h = 0; h < nhosts; h++){
+      S[h] = &S_[h].write()[0];
+      I[h] = &I_[h].write()[0];
+    }
+    char* is_infected = &is_infected_.write()[0];
+    std::vector<std::vector<int> > fresh(threads), changed(threads);
+    std::vector<std::vector<long> > infections(threads, std::vector<long>(nhosts, 0));
+    long n = long(landings.size());
+    #pragma omp parallel num_threads(threads)
+    {
+#ifdef _OPENMP
+      int self = omp_get_thread_num();
+#else
+      int self = 0;
+#endif
+      std::vector<int> seen(nhosts);
+      #pragma omp for schedule(dynamic, 1024)
+      for (long k = 0; k < n; k++){
+        const Landing& l = landings[k];
+        if (l.dest < offset || l.dest >= end) continue;
+        int dest = l.dest - offset;
+        int h = challenge_concurrent(S, dest, l.dest == l.source, weather, l, seen);
+        if (h < 0) continue;
+        __atomic_fetch_add(&I[h][dest], 1, __ATOMIC_RELAXED);
+        infections[self][h]++;
+        changed[self].push_back(dest);
+        if (!__atomic_exchange_n(&is_infected[dest], char(1), __ATOMIC_RELAXED)) fresh[self].push_back(dest);
+      }
+    }
+    for (int t = 0; t < threads; t++){
+      for (std::size_t h = 0; h < nhosts; h++){
+        infected_total_[h] += infections[t][h];
+        susceptible_total_ -= infections[t][h];
+      }
+      infected_.insert(infected_.end(), fresh[t].begin(), fresh[t].end());
+      for (std::size_t k = 0; k < fresh[t].size(); k++) include(fresh[t][k]);
+      for (std::size_t k = 0; k < changed[t].size(); k++) refresh(changed[t][k]);
+    }
+  }
+
+  // challenge() against the counts of the cell as read by this thread; the
+  // susceptible of the picked host is removed with a compare-and-swap. Returns
+  // the infected host, -1 if the spore does not infect.
+  int challenge_concurrent(const std::vector<int*>& S, int dest, bool same_cell, const float* weather,
+                           const Landing& l, std::vector<int>& seen) const {
+    if (N_[dest] <= 0) return -1;
+    double w = weather ? weather[dest] : 1.0;
+    while (true){
+      double challenged = 0;
+      for (std::size_t h = 0; h < S.size(); h++){
+        seen[h] = __atomic_load_n(&S[h][dest], __ATOMIC_RELAXED);
+        challenged += seen[h] * (same_cell ? 1.0 : score_[h]);
+      }
+      if (!(challenged > 0)) return -1;
+      double prob = challenged / N_[dest] * w;
+      if (l.u_infect >= prob) return -1;
+
+      double pick = l.u_pick * challenged;
+      std::size_t h = 0;
+      for (; h + 1 < S.size(); h++){
+        pick -= seen[h] * (same_cell ? 1.0 : score_[h]);
+        if (pick < 0) break;
+      }
+      while (seen[h] <= 0 && h > 0) h--;
+      int expected = seen[h];
+      if (expected <= 0) return -1;
+      if (__atomic_compare_exchange_n(&S[h][dest], &expected, expected - 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return int(h);
+      // another thread infected a host of the cell in between: decide again on the new counts
+    }
+  }
+
+  void infect(int h, int cell){
+    S_[h].write()[cell]--;
+    I_[h].write()[cell]++;
+    infected_total_[h]++;
+    susceptible_total_--;
+    refresh(cell);
+    if (!is_infected_[cell]){
+      is_infected_.write()[cell] = 1;
+      infected_.push_back(cell);
+      include(cell);
+    }
+  }
+
+  int nrow_, ncol_;
+  int row_begin_, global_nrow_;
+  std::vector<SharedGrid> S_, I_;
+  SharedGrid N_;
+  std::vector<double> score_;
+  std::vector<double> lethal_temp_;
+  SpreadParams params_;
+
+  std::vector<int> infected_;
+  SharedArray<char> is_infected_;        // copy-on-write like the host grids, so a fork copies nothing up front
+  SharedArray<CellHosts> cells_;        // per cell, refreshed on every change of its hosts
+
+  // working memory of land_aggregated(), all 0 between steps; not copied with
+  // the simulation
+  struct Scratch {
+    std::vector<int> values;
+    Scratch() {}
+    Scratch(const Scratch&) {}
+    Scratch& operator=(const Scratch&){ return *this; }
+  };
+  Scratch hits_;
+
+  int reach_;
+  Window infected_window_;
+  Window touched_;
+  std::vector<long> infected_total_;
+  long susceptible_total_;
+};
+
+// weather inputs of a run, indexed by step (suitability) and by year (critical temperature)
+class WeatherSource {
+public:
+  virtual ~WeatherSource() {}
+  // suitability grid of a step, NULL if weather does not limit spread
+  virtual const float* suitability(int step) = 0;
+  // critical temperature grid of a year, NULL if there is none
+  virtual const float* crit_temp(int year) = 0;
+  // wind field of a step (see WindField), none by default
+  virtual WindField wind(int /*step*/) { return WindField(); }
+
+  // The same, needed only inside 'window' (global rows and columns of the study
+  // area): a source reading the weather as the run goes may leave the other
+  // cells unset. A second call for the same step with a larger window must keep
+  // the values of the first window where the first call returned them.
+  virtual const float* suitability_in(int step, const Window&) { return suitability(step); }
+  virtual const float* crit_temp_in(int year, const Window&) { return crit_temp(year); }
+  virtual WindField wind_in(int step, const Window&) { return wind(step); }
+};
+
+// callbacks of the driver
+class StepObserver {
+public:
+  virtual ~StepObserver() {}
+  virtual bool cancelled() { return false; }
+  virtual void output(const ScheduledStep&, const Simulation&) {}
+  virtual void step_done(const ScheduledStep&, const Simulation&, int /*done*/, int /*total*/) {}
+};
+
+// Communication between the strips of a decomposed study area (see
+// decomposition.h). Part p owns the global rows [bounds[p], bounds[p+1]).
+class Exchange {
+public:
+  virtual ~Exchange() {}
+  virtual int rank() const = 0;
+  virtual int size() const = 0;
+  virtual const std::vector<int>& bounds() const = 0;
+  // send outbox[p] to part p and receive the landings sent to this part,
+  // concatenated in part order
+  virtual void exchange(std::vector<std::vector<Landing> >& outbox, std::vector<Landing>& inbox) = 0;
+  // sum of a value over all parts
+  virtual long sum(long value) = 0;
+};
+
+// a single part owning the whole study area
+class LocalExchange : public Exchange {
+public:
+  explicit LocalExchange(int nrow){
+    bounds_.push_back(0);
+    bounds_.push_back(nrow);
+  }
+  int rank() const { return 0; }
+  int size() const { return 1; }
+  const std::vector<int>& bounds() const { return bounds_; }
+  void exchange(std::vector<std::vector<Landing> >& outbox, std::vector<Landing>& inbox){ inbox.swap(outbox[0]); }
+  long sum(long value){ return value; }
+
+private:
+  std::vector<int> bounds_;
+};
+
+// Spread step of one part: disperse the spores of the strip, send every landing
+// to the part owning its destination and resolve the landings received.
+// Each part sends its landings in order of source cell and parts own increasing
+// rows, so the concatenated inbox is in the global (source cell, spore) order
+// a single process would use.
+// The weather is read in the active window of the strip, and read again in a
+// larger window if spores from the tail of the kernel reached hosts beyond it.
+inline void spread(Simulation& sim, int step, WeatherSource& weather, Exchange& exchange){
+  Window window = sim.active_window();
+  const float* suitability = weather.suitability_in(step, window);
+  WindField wind = weather.wind_in(step, sim.infected_window());
+  std::vector<Landing> landings;
+  sim.disperse(step, suitability, landings, wind);
+  std::vector<Landing> inbox;
+  if (exchange.size() == 1){
+    inbox.swap(landings);
+  }else{
+    const std::vector<int>& bounds = exchange.bounds();
+    std::vector<std::vector<Landing> > outbox(exchange.size());
+    for (std::size_t k = 0; k < landings.size(); k++){
+      int row = landings[k].dest / sim.ncol();
+      int part = int(std::upper_bound(bounds.begin(), bounds.end(), row) - bounds.begin()) - 1;
+      outbox[part].push_back(landings[k]);
+    }
+    exchange.exchange(outbox, inbox);
+  }
+  Window reached = sim.landing_window(inbox);
+  if (!window.contains(reached)){
+    window.include(reached);
+    if (suitability) suitability = weather.suitability_in(step, window);
+  }
+  sim.touch(window);
+  sim.land(step, inbox, suitability);
+}
+
+// Walk the schedule: mortality, spread and yearly output on each scheduled step.
+// With a decomposed study area every part runs this loop on its own strip; the
+// decisions that must be the same everywhere (cancel, no susceptible host left)
+// are taken on the sums over all parts.
+// Returns false if the run was cancelled by the observer.
+inline bool run(Simulation& sim, const Schedule& schedule, WeatherSource& weather, StepObserver& observer,
+                Exchange& exchange){
+  const std::vector<ScheduledStep>& events = schedule.events();
+  int n = int(events.size());
+  for (int k = 0; k < n; k++){
+    if (exchange.sum(observer.cancelled() ? 1 : 0) > 0) return false;
+    const ScheduledStep& e = events[k];
+    // once no susceptible host is left only the yearly outputs remain
+    if (exchange.sum(sim.susceptible_total()) > 0){
+      if (e.mortality){
+        const float* crit = weather.crit_temp_in(e.date.year, sim.infected_window());
+        if (crit) sim.mortality(crit);
+      }
+      if (e.active) spread(sim, e.step, weather, exchange);
+    }
+    if (e.output) observer.output(e, sim);
+    observer.step_done(e, sim, k + 1, n);
+  }
+  return true;
+}
+
+inline bool run(Simulation& sim, const Schedule& schedule, WeatherSource& weather, StepObserver& observer){
+  LocalExchange exchange(sim.nrow());
+  return run(sim, schedule, weather, observer, exchange);
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef POPS_ENGINE_SPARSE_OUTPUT_H
+#define POPS_ENGINE_SPARSE_OUTPUT_H
+
+// Compressed infected grids for the yearly outputs.
+//
+// An infected grid is zero almost everywhere: a run over a large study area
+// infects a small fraction of its cells, so storing a dense grid per host and
+// output year costs far more than the infection itself. A SparseLayer keeps
+// only the infected cells, in increasing cell order, as pairs (gap to the
+// previous infected cell, number of infected hosts) written as variable length
+// integers (7 bits per byte, high bit = more bytes follow). A cluster of
+// infected cells costs about two bytes per cell; an empty grid costs nothing.
+//
+// Layers are built from the list of infected cells of a simulation, so
+// encoding visits the infection rather than the whole grid, and are decoded
+// into a dense grid only when a year is looked at.
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace pops {
+
+class SparseLayer {
+public:
+  SparseLayer() : ncell_(0), cells_(0), total_(0) {}
+
+  // layer of 'grid' (ncell values); 'cells' holds every cell with a value
+  // greater than zero, in any order, possibly with other cells
+  static SparseLayer encode(const std::vector<int>& grid, std::vector<int> cells){
+    SparseLayer layer;
+    layer.ncell_ = grid.size();
+    std::sort(cells.begin(), cells.end());
+    long prev = -1;
+    for (std::size_t k = 0; k < cells.size(); k++){
+      int cell = cells[k];
+      if (cell == prev || grid[cell] <= 0) continue;
+      layer.put(unsigned(cell - prev));
+      layer.put(unsigned(grid[cell]));
+      layer.cells_++;
+      layer.total_ += grid[cell];
+      prev = cell;
+    }
+    return layer;
+  }
+
+  // layer of a whole grid (every cell is visited)
+  static SparseLayer encode(const std::vector<int>& grid){
+    std::vector<int> cells;
+    for (std::size_t cell = 0; cell < grid.size(); cell++)
+      if (grid[cell] > 0) cells.push_back(int(cell));
+    return encode(grid, cells);
+  }
+
+  // layer read back from bytes written by bytes()
+  static SparseLayer decode_bytes(const std::vector<unsigned char>& bytes, std::size_t ncell){
+    SparseLayer layer;
+    layer.ncell_ = ncell;
+    layer.bytes_ = bytes;
+    for (Reader r(layer); r.next(); ){
+      layer.cells_++;
+      layer.total_ += r.value;
+    }
+    return layer;
+  }
+
+  std::size_t ncell() const { return ncell_; }
+  // infected cells and infected hosts of the layer
+  long cells() const { return cells_; }
+  long total() const { return total_; }
+  const std::vector<unsigned char>& bytes() const { return bytes_; }
+
+  // f(cell, value) for every infected cell, in increasing cell order
+  template <typename F>
+  void for_each(F f) const {
+    for (Reader r(*this); r.next(); ) f(r.cell, r.value);
+  }
+
+  // dense grid of the layer (zeros elsewhere)
+  std::vector<int> dense() const {
+    std::vector<int> grid(ncell_, 0);
+    for (Reader r(*this); r.next(); ) grid[r.cell] = r.value;
+    return grid;
+  }
+
+private:
+  struct Reader {
+    explicit Reader(const SparseLayer& layer) : layer(layer), pos(0), cell(-1), value(0) {}
+    bool next(){
+      if (pos >= layer.bytes_.size()) return false;
+      cell += long(get());
+      value = int(get());
+      if (cell < 0 || std::size_t(cell) >= layer.ncell_) throw std::runtime_error("corrupt sparse layer");
+      return true;
+    }
+    unsigned get(){
+      unsigned v = 0;
+      for (int shift = 0; ; shift += 7){
+        if (pos >= layer.bytes_.size() || shift > 28) throw std::runtime_error("corrupt sparse layer");
+        unsigned char b = layer.bytes_[pos++];
+        v |= unsigned(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+      }
+    }
+    const SparseLayer& layer;
+    std::size_t pos;
+    long cell;
+    int value;
+  };
+
+  void put(unsigned v){
+    while (v >= 0x80){
+      bytes_.push_back((unsigned char)(v | 0x80));
+      v >>= 7;
+    }
+    bytes_.push_back((unsigned char)v);
+  }
+
+  std::size_t ncell_;
+  long cells_;
+  long total_;
+  std::vector<unsigned char> bytes_;
+};
+
+// (cell, infected hosts) of the infected cells, in increasing cell order
+typedef std::vector<std::pair<int, int> > CellCounts;
+
+// infected hosts summed over the layers of the hosts
+inline CellCounts sum_layers(const std::vector<SparseLayer>& layers){
+  CellCounts out;
+  for (std::size_t h = 0; h < layers.size(); h++){
+    CellCounts host, merged;
+    host.reserve(layers[h].cells());
+    layers[h].for_each([&host](long cell, int value){ host.push_back(std::make_pair(int(cell), value)); });
+    if (out.empty()){
+      out.swap(host);
+      continue;
+    }
+    merged.reserve(out.size() + host.size());
+    std::size_t a = 0, b = 0;
+    while (a < out.size() || b < host.size()){
+      if (b == host.size() || (a < out.size() && out[a].first < host[b].first)) merged.push_back(out[a++]);
+      else if (a == out.size() || host[b].first < out[a].first) merged.push_back(host[b++]);
+      else {
+        merged.push_back(std::make_pair(out[a].first, out[a].second + host[b].second));
+        a++;
+        b++;
+      }
+    }
+    out.swap(merged);
+  }
+  return out;
+}
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef POPS_ENGINE_WEATHER_H
+#define POPS_ENGINE_WEATHER_H
+
+// Weather coefficients (Mcoef/Ccoef) from daily Daymet layers in one streaming
+// pass.
+//
+// Days are fed in date order. Each day is added to the running per-cell sums
+// of its period, which is a day, a week, or a month of the simulation clock.
+// The clock is the same as in schedule.h: weeks are 7-day blocks counted from
+// January 1st of the start year, so period k is the coefficient of step k + 1.
+// When a day of a new period arrives, the finished period is turned into a
+// coefficient grid and handed to the caller. Only the sums of the current
+// period are kept in memory.
+//
+// The two methods of weather_coeff() are supported:
+//  - threshold:  share of the days of the period with a value above the
+//                threshold;
+//  - polynomial: a0 + a1 (m + x1mod) + a2 (m + x2mod)^2 + a3 (m + x3mod)^3 of
+//                the mean m of the period, clamped to [0, 1].
+// Missing values (NaN, masked cells) are skipped; a cell with no valid day in a
+// period gets NaN.
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "schedule.h"
+
+namespace pops {
+
+// period of a date on the simulation clock starting on January 1st of start_year
+inline long period_index(StepUnit unit, int start_year, const Date& d){
+  switch (unit){
+  case STEP_DAY:
+    return days_from_civil(d.year, d.month, d.day) - days_from_civil(start_year, 1, 1);
+  case STEP_WEEK:
+    return (days_from_civil(d.year, d.month, d.day) - days_from_civil(start_year, 1, 1)) / 7;
+  case STEP_MONTH:
+    return long(d.year - start_year) * 12 + d.month - 1;
+  }
+  return 0;
+}
+
+struct CoefficientMethod {
+  bool polynomial;
+  double thresh;
+  double a0, a1, a2, a3;
+  double x1mod, x2mod, x3mod;
+
+  // value accumulated for one day
+  double daily(double v) const {
+    if (polynomial) return v;
+    return v > thresh ? 1.0 : 0.0;
+  }
+
+  // coefficient of a period from the mean of its daily values
+  double coefficient(double mean) const {
+    if (!polynomial) return mean;
+    double c = a0 + a1 * (mean + x1mod) + a2 * std::pow(mean + x2mod, 2) + a3 * std::pow(mean + x3mod, 3);
+    if (c < 0) c = 0;   // restrain lower limit to 0
+    if (c > 1) c = 1;   // restrain upper limit to 1
+    return c;
+  }
+};
+
+inline CoefficientMethod coefficient_method(const std::string& name){
+  CoefficientMethod m = CoefficientMethod();
+  if (name == "polynomial") m.polynomial = true;
+  else if (name == "threshold") m.polynomial = false;
+  else throw std::invalid_argument("the index method must be either 'threshold' or 'polynomial'");
+  return m;
+}
+
+class CoefficientAccumulator {
+public:
+  // mask: optional, cells with mask 0 are outside of the study area
+  CoefficientAccumulator(std::size_t ncell, const CoefficientMethod& method, const std::vector<char>& mask = std::vector<char>())
+    : method_(method), mask_(mask), sum_(ncell, 0.0), count_(ncell, 0), period_(-1){
+    if (!mask_.empty() && mask_.size() != ncell) throw std::invalid_argument("the mask does not match the weather grid");
+  }
+
+  long period() const { return period_; }
+
+  // Add the daily values of one day of 'period'. If the day starts a new
+  // period, the coefficients of the previous one are written to 'finished'
+  // (with its index in finished_period) and true is returned.
+  template <typename T>
+  bool add(long period, const T* values, std::vector<float>& finished, long& finished_period){
+    if (period < period_) throw std::invalid_argument("days must be given in date order");
+    bool done = false;
+    if (period != period_ && period_ >= 0){
+      done = flush(finished, finished_period);
+    }
+    period_ = period;
+    long n = long(sum_.size());
+    #pragma omp parallel for schedule(static)
+    for (long cell = 0; cell < n; cell++){
+      if (!mask_.empty() && !mask_[cell]) continue;
+      double v = values[cell];
+      if (std::isnan(v)) continue;
+      sum_[cell] += method_.daily(v);
+      count_[cell]++;
+    }
+    return done;
+  }
+
+  // coefficients of the current period (call once after the last day)
+  bool flush(std::vector<float>& finished, long& finished_period){
+    if (period_ < 0) return false;
+    long n = long(sum_.size());
+    finished.resize(sum_.size());
+    #pragma omp parallel for schedule(static)
+    for (long cell = 0; cell < n; cell++){
+      finished[cell] = count_[cell] > 0 ? float(method_.coefficient(sum_[cell] / count_[cell])) : NAN;
+      sum_[cell] = 0;
+      count_[cell] = 0;
+    }
+    finished_period = period_;
+    period_ = -1;
+    return true;
+  }
+
+private:
+  CoefficientMethod method_;
+  std::vector<char> mask_;
+  std::vector<double> sum_;
+  std::vector<int> count_;
+  long period_;
+};
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef POPS_ENGINE_WEATHER_BANK_H
+#define POPS_ENGINE_WEATHER_BANK_H
+
+// Read-only bank of historical weather years for future scenarios.
+//
+// climGen() used to build the weather of every scenario (and replicate) by
+// grepping file lists and stacking the rasters of the sampled years again. The
+// bank instead holds the suitability layers (and the critical temperature) of
+// each historical year once; a scenario is only a list saying which historical
+// year stands for each simulated year, and a ScenarioWeather reads the bank
+// through that list. Any number of replicates can share one bank (it is never
+// modified after loading, so it can be read from several jobs at once).
+//
+// Layers of a year are indexed by period within the year on the simulation
+// clock: day of the year, week (7-day block from January 1st) or month.
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rng.h"
+#include "schedule.h"
+#include "simulation.h"
+
+namespace pops {
+
+class WeatherBank {
+public:
+  WeatherBank(std::size_t ncell, StepUnit unit) : ncell_(ncell), unit_(unit) {}
+
+  std::size_t ncell() const { return ncell_; }
+  StepUnit unit() const { return unit_; }
+
+  void add_layer(int year, int index, const std::vector<float>& grid){
+    check(grid);
+    std::vector<std::vector<float> >& layers = years_[year];
+    if (int(layers.size()) <= index) layers.resize(index + 1);
+    layers[index] = grid;
+  }
+
+  void add_crit_temp(int year, const std::vector<float>& grid){
+    check(grid);
+    crit_temp_[year] = grid;
+  }
+
+  // historical years ordered from the most to the least favorable (WeatherRanked.csv)
+  void set_ranking(const std::vector<int>& ranked){
+    for (std::size_t k = 0; k < ranked.size(); k++)
+      if (!has_year(ranked[k])) throw std::invalid_argument("a ranked year is not in the weather bank");
+    ranked_ = ranked;
+  }
+  const std::vector<int>& ranking() const { return ranked_; }
+
+  bool has_year(int year) const { return years_.count(year) > 0; }
+  int last_year() const { return years_.empty() ? 0 : years_.rbegin()->first; }
+
+  // layer 'index' of a year; the last layer of the year stands in for periods
+  // past it (week 53, day 366); NULL if the year is not in the bank
+  const float* layer(int year, int index) const {
+    std::map<int, std::vector<std::vector<float> > >::const_iterator it = years_.find(year);
+    if (it == years_.end() || it->second.empty()) return 0;
+    index = std::min(index, int(it->second.size()) - 1);
+    const std::vector<float>& grid = it->second[index];
+    return grid.empty() ? 0 : &grid[0];
+  }
+
+  const float* crit_temp(int year) const {
+    std::map<int, std::vector<float> >::const_iterator it = crit_temp_.find(year);
+    return it == crit_temp_.end() ? 0 : &it->second[0];
+  }
+
+private:
+  void check(const std::vector<float>& grid) const {
+    if (grid.size() != ncell_) throw std::invalid_argument("weather layers must all have the same dimensions");
+  }
+
+  std::size_t ncell_;
+  StepUnit unit_;
+  std::map<int, std::vector<std::vector<float> > > years_;
+  std::map<int, std::vector<float> > crit_temp_;
+  std::vector<int> ranked_;
+};
+
+enum WeatherScenario { SCENARIO_NONE, SCENARIO_RANDOM, SCENARIO_FAVORABLE, SCENARIO_UNFAVORABLE };
+
+inline WeatherScenario weather_scenario(const std::string& name){
+  if (name.empty() || name == "none") return SCENARIO_NONE;
+  if (name == "random") return SCENARIO_RANDOM;
+  if (name == "favorable") return SCENARIO_FAVORABLE;
+  if (name == "unfavorable") return SCENARIO_UNFAVORABLE;
+  throw std::invalid_argument("the weather scenario must be 'random', 'favorable' or 'unfavorable'");
+}
+
+// Historical year standing for each simulated year start..end: years in the
+// bank are used as they are, later years are drawn (with replacement) from all
+// ranked years, from the favorable (upper) half or from the unfavorable (lower)
+// half of the ranking, as climGen() does. 'stream' tells the replicates apart.
+inline std::vector<int> scenario_years(const WeatherBank& bank, int start, int end, WeatherScenario scenario,
+                                       uint64_t seed, uint64_t stream = 0){
+  std::vector<int> years;
+  const std::vector<int>& ranked = bank.ranking();
+  std::size_t half = ranked.size() / 2;
+  std::size_t first = scenario == SCENARIO_UNFAVORABLE ? half : 0;
+  std::size_t last = scenario == SCENARIO_FAVORABLE ? half : ranked.size();
+  Rng rng(seed, stream, 0x5CE4A710ULL);
+  for (int year = start; year <= end; year++){
+    if (bank.has_year(year)){
+      years.push_back(year);
+      continue;
+    }
+    if (scenario == SCENARIO_NONE)
+      throw std::invalid_argument("a future weather scenario is needed for years after the last year of the weather bank");
+    if (last <= first) throw std::invalid_argument("the weather ranking has too few years for this scenario");
+    std::size_t pick = first + std::size_t(rng.uniform() * (last - first));
+    years.push_back(ranked[std::min(pick, last - 1)]);
+  }
+  return years;
+}
+
+// weather of a simulation whose year start + k uses the bank year years[k]
+class ScenarioWeather : public WeatherSource {
+public:
+  ScenarioWeather(std::shared_ptr<const WeatherBank> bank, int start, const std::vector<int>& years)
+    : bank_(bank), start_(start), years_(years) {}
+
+  const float* suitability(int step){
+    int year, index;
+    locate(step, year, index);
+    int k = year - start_;
+    if (k < 0 || k >= int(years_.size())) return 0;
+    return bank_->layer(years_[k], index);
+  }
+
+  const float* crit_temp(int year){
+    int k = year - start_;
+    if (k < 0 || k >= int(years_.size())) return 0;
+    return bank_->crit_temp(years_[k]);
+  }
+
+private:
+  // calendar year of a step and its period within that year
+  void locate(int step, int& year, int& index) const {
+    if (bank_->unit() == STEP_MONTH){
+      year = start_ + (step - 1) / 12;
+      index = (step - 1) % 12;
+      return;
+    }
+    long first = days_from_civil(start_, 1, 1);
+    long day = first + long(step - 1) * (bank_->unit() == STEP_WEEK ? 7 : 1);
+    Date d = civil_from_days(day);
+    year = d.year;
+    long in_year = day - days_from_civil(d.year, 1, 1);
+    index = int(bank_->unit() == STEP_WEEK ? in_year / 7 : in_year);
+  }
+
+  std::shared_ptr<const WeatherBank> bank_;
+  int start_;
+  std::vector<int> years_;
+};
+
+} // namespace pops
+
+#endif
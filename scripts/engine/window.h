@@ -0,0 +1,67 @@
+#ifndef POPS_ENGINE_WINDOW_H
+#define POPS_ENGINE_WINDOW_H
+
+// Rectangular windows of the study area.
+//
+// An outbreak usually starts in a small corner of a large study area, yet the
+// weather of every step used to be read for the whole extent. The driver now
+// asks the weather only for the active window of a step (see spread() in
+// simulation.h): the bounding window of the infected cells grown by the reach
+// of the kernel, plus any cell with hosts that a spore from the tail of the
+// kernel reached beyond it. Rows are global rows of the study area; a window
+// covers rows [row0, row1) and columns [col0, col1).
+
+#include <algorithm>
+
+namespace pops {
+
+struct Window {
+  int row0, row1, col0, col1;
+
+  Window() : row0(0), row1(0), col0(0), col1(0) {}
+  Window(int row0, int row1, int col0, int col1) : row0(row0), row1(row1), col0(col0), col1(col1) {}
+
+  bool empty() const { return row1 <= row0 || col1 <= col0; }
+  int nrow() const { return empty() ? 0 : row1 - row0; }
+  int ncol() const { return empty() ? 0 : col1 - col0; }
+  long cells() const { return long(nrow()) * ncol(); }
+
+  bool contains(int row, int col) const { return row >= row0 && row < row1 && col >= col0 && col < col1; }
+  bool contains(const Window& w) const {
+    return w.empty() || (!empty() && w.row0 >= row0 && w.row1 <= row1 && w.col0 >= col0 && w.col1 <= col1);
+  }
+
+  // grow to include a cell, or another window
+  void include(int row, int col){
+    if (empty()){
+      *this = Window(row, row + 1, col, col + 1);
+      return;
+    }
+    row0 = std::min(row0, row);
+    row1 = std::max(row1, row + 1);
+    col0 = std::min(col0, col);
+    col1 = std::max(col1, col + 1);
+  }
+  void include(const Window& w){
+    if (w.empty()) return;
+    if (empty()){
+      *this = w;
+      return;
+    }
+    row0 = std::min(row0, w.row0);
+    row1 = std::max(row1, w.row1);
+    col0 = std::min(col0, w.col0);
+    col1 = std::max(col1, w.col1);
+  }
+
+  // grown by 'cells' on every side, within a study area of nrow x ncol
+  Window expanded(int cells, int nrow, int ncol) const {
+    if (empty()) return *this;
+    return Window(std::max(0, row0 - cells), std::min(nrow, row1 + cells),
+                  std::max(0, col0 - cells), std::min(ncol, col1 + cells));
+  }
+};
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef POPS_ENGINE_WORK_STEALING_H
+#define POPS_ENGINE_WORK_STEALING_H
+
+// Work stealing over a list of weighted tasks.
+//
+// Spore loads are very uneven: a few dense cells produce thousands of spores
+// while most infected cells produce a handful, so giving each thread the same
+// number of cells leaves most threads idle. A StealingQueue first splits the
+// tasks 0..n-1 into one contiguous range per thread holding about the same
+// total weight. A thread takes tasks from the front of its own range; once it
+// is empty it steals tasks from the back of the ranges of the others, so
+// threads that drew light tasks (or were descheduled) finish the work of the
+// others. The bounds of a range are packed in one atomic word, so taking and
+// stealing are a single compare-and-swap each, without locks.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace pops {
+
+class StealingQueue {
+public:
+  // weights: weight of each task (e.g. spores), in task order
+  StealingQueue(const std::vector<long>& weights, int threads)
+    : threads_(threads < 1 ? 1 : threads), ranges_(new Range[threads < 1 ? 1 : threads]){
+    long total = 0;
+    for (std::size_t t = 0; t < weights.size(); t++) total += weights[t];
+    // range p ends at the first task where the running weight reaches (p + 1) / threads of the total
+    std::size_t begin = 0, task = 0;
+    long running = 0;
+    for (int p = 0; p < threads_; p++){
+      long target = long(double(total) * (p + 1) / threads_);
+      while (task < weights.size() && (running < target || p + 1 == threads_)){
+        running += weights[task];
+        task++;
+      }
+      ranges_[p].bounds.store(pack(begin, task));
+      begin = task;
+    }
+  }
+
+  int threads() const { return threads_; }
+
+  // next task of 'thread': from its own range, else stolen from another
+  bool next(int thread, std::size_t& task){
+    if (take_front(ranges_[thread], task)) return true;
+    for (int k = 1; k < threads_; k++)
+      if (take_back(ranges_[(thread + k) % threads_], task)){
+        steals_++;
+        return true;
+      }
+    return false;
+  }
+
+  // tasks taken from another thread's range so far
+  long steals() const { return steals_; }
+
+private:
+  struct Range {
+    std::atomic<uint64_t> bounds;   // begin << 32 | end
+    char pad[64 - sizeof(std::atomic<uint64_t>)];
+    Range() : bounds(0) {}
+  };
+
+  static uint64_t pack(std::size_t begin, std::size_t end){ return (uint64_t(begin) << 32) | uint64_t(end); }
+
+  static bool take_front(Range& r, std::size_t& task){
+    uint64_t b = r.bounds.load();
+    while (true){
+      uint64_t begin = b >> 32, end = b & 0xFFFFFFFFULL;
+      if (begin >= end) return false;
+      if (r.bounds.compare_exchange_weak(b, pack(begin + 1, end))){
+        task = std::size_t(begin);
+        return true;
+      }
+    }
+  }
+
+  static bool take_back(Range& r, std::size_t& task){
+    uint64_t b = r.bounds.load();
+    while (true){
+      uint64_t begin = b >> 32, end = b & 0xFFFFFFFFULL;
+      if (begin >= end) return false;
+      if (r.bounds.compare_exchange_weak(b, pack(begin, end - 1))){
+        task = std::size_t(end - 1);
+        return true;
+      }
+    }
+  }
+
+  int threads_;
+  std::unique_ptr<Range[]> ranges_;
+  std::atomic<long> steals_{0};
+};
+
+} // namespace pops
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef POPS_ENGINE_ZONES_H
+#define POPS_ENGINE_ZONES_H
+
+// Zonal summaries of the infection (per state, county, ...).
+//
+// State and county totals used to be computed by overlaying the polygons on
+// every output raster, which takes minutes per layer. The polygons are now
+// rasterized once onto the grid of the runs into a zone grid (0 = outside
+// every zone, 1..n = zone number), and the infected hosts and infected cells
+// of each zone are summed from the infected cells at every yearly output, so
+// the summaries come with every run at the cost of one lookup per infected
+// cell. A ZoneIndex is read-only and shared by all the jobs using it.
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "sparse_output.h"
+
+namespace pops {
+
+// infected hosts and cells per zone at one output
+struct ZonalSummary {
+  int nzones, nhosts;
+  std::vector<long> hosts;   // infected hosts of zone z (1..n) and host h at (z - 1) * nhosts + h
+  std::vector<long> cells;   // cells of zone z with infected hosts (any host) at z - 1
+
+  long infected(int zone, int host) const { return hosts[std::size_t(zone - 1) * nhosts + host]; }
+  long infected_cells(int zone) const { return cells[zone - 1]; }
+};
+
+class ZoneIndex {
+public:
+  ZoneIndex(const std::vector<int>& zones, int nzones) : zones_(zones), nzones_(nzones), size_(nzones, 0){
+    if (nzones < 1) throw std::invalid_argument("a zone index needs at least one zone");
+    for (std::size_t cell = 0; cell < zones_.size(); cell++){
+      int z = zones_[cell];
+      if (z < 0 || z > nzones_) throw std::invalid_argument("zones must range between 0 and the number of zones");
+      if (z > 0) size_[z - 1]++;
+    }
+  }
+
+  std::size_t ncell() const { return zones_.size(); }
+  int nzones() const { return nzones_; }
+  int zone(std::size_t cell) const { return zones_[cell]; }
+  // cells of zone z (1..n)
+  long zone_cells(int zone) const { return size_[zone - 1]; }
+
+  // summary of the infected hosts of every host (one sparse layer per host)
+  ZonalSummary summarize(const std::vector<SparseLayer>& layers) const {
+    ZonalSummary out;
+    out.nzones = nzones_;
+    out.nhosts = int(layers.size());
+    out.hosts.assign(std::size_t(nzones_) * layers.size(), 0);
+    out.cells.assign(nzones_, 0);
+    for (std::size_t h = 0; h < layers.size(); h++){
+      if (layers[h].ncell() != zones_.size()) throw std::invalid_argument("the zone index does not have the grid of the simulation");
+      layers[h].for_each([&](long cell, int value){
+        int z = zones_[cell];
+        if (z > 0) out.hosts[std::size_t(z - 1) * layers.size() + h] += value;
+      });
+    }
+    if (layers.size() == 1){
+      layers[0].for_each([&](long cell, int){
+        int z = zones_[cell];
+        if (z > 0) out.cells[z - 1]++;
+      });
+    }else{
+      CellCounts all = sum_layers(layers);
+      for (std::size_t k = 0; k < all.size(); k++){
+        int z = zones_[all[k].first];
+        if (z > 0) out.cells[z - 1]++;
+      }
+    }
+    return out;
+  }
+
+private:
+  std::vector<int> zones_;
+  int nzones_;
+  std::vector<long> size_;
+};
+
+} // namespace pops
+
+#endif
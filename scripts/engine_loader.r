@@ -0,0 +1,15 @@
+#load the native kernels (SimJobStartCpp, SporeDispCpp_mh, ...): from the prebuilt popsengine package when it is installed
+#(R CMD INSTALL popsengine, built once with OpenMP and native routine registration), otherwise compiled from
+#scripts/myCppFunctions2.cpp with sourceCpp. Does nothing once the kernels are loaded, so it can be called at the start
+#of every function that needs them.
+loadEngine <- function(){
+  
+  if (exists("EngineBuildInfoCpp", mode = "function")) return(invisible(TRUE))
+  if (requireNamespace("popsengine", quietly = TRUE)){
+    suppressPackageStartupMessages(library(popsengine))
+  }else{
+    sourceCpp("scripts/myCppFunctions2.cpp", env = globalenv())
+  }
+  invisible(TRUE)
+  
+}
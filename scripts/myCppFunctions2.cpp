@@ -1,7 +1,20 @@
 #include <Rcpp.h>
 #include <omp.h>
+#include "engine/mortality.h"
+#include "engine/schedule.h"
+#include "engine/job.h"
+#include "engine/weather.h"
+#include "engine/weather_bank.h"
+#include "engine/ranking.h"
+#include "engine/landscape_pack.h"
+#include "engine/platform.h"
+#include "engine/ensemble.h"
+#include "engine/comparison.h"
+#include "engine/zones.h"
+#include "engine/emulator.h"
 using namespace Rcpp;
 // [[Rcpp::plugins(openmp)]]
+// [[Rcpp::plugins(cpp11)]]
 
 //Within each infected cell (I > 0) draw random number of infections ~Poisson(lambda=rate of spore production) for each infected host. 
 //Take SUM for total infections produced by each cell. 
@@ -630,4 +643,1070 @@ double d_return(double scale1) {
   double dist = R::rexp(scale1);
   return dist;
 }
-               
+
+//Yearly cold-temperature mortality: in cells where the critical temperature of the year is below the lethal
+//temperature of a host, infected individuals of that host are cleared and go back to susceptible.
+//Only cells with infected hosts are visited; lethal_temp is recycled over hosts (NA = host not affected).
+
+// [[Rcpp::export]]
+List ColdMortalityCpp(List S_list, List I_list, NumericMatrix crit_temp, NumericVector lethal_temp, int number_of_hosts){
+
+  int ncell = crit_temp.nrow() * crit_temp.ncol();
+  if (lethal_temp.size() == 0) stop("lethal_temp must have at least one value");
+
+  List S_out(number_of_hosts);
+  List I_out(number_of_hosts);
+  std::vector<pops::HostGrids> hosts;
+  for (int h = 0; h < number_of_hosts; h++){
+    IntegerMatrix S_mat = as<IntegerMatrix>(S_list[h]);
+    IntegerMatrix I_mat = as<IntegerMatrix>(I_list[h]);
+    if (S_mat.nrow() * S_mat.ncol() != ncell || I_mat.nrow() * I_mat.ncol() != ncell)
+      stop("host matrices and crit_temp must have the same dimensions");
+    S_out[h] = S_mat;
+    I_out[h] = I_mat;
+    pops::HostGrids g = {S_mat.begin(), I_mat.begin(), lethal_temp[h % lethal_temp.size()]};
+    hosts.push_back(g);
+  }
+
+  std::vector<int> cells;
+  std::vector<long> removed;
+  pops::infected_cells(hosts, ncell, cells);
+  pops::cold_mortality(hosts, crit_temp.begin(), cells, removed);
+
+  return List::create(
+    _["S"] = S_out,
+    _["I"] = I_out,
+    _["removed"] = NumericVector(removed.begin(), removed.end()),
+    _["infected_cells"] = int(cells.size())
+  );
+}
+
+//Schedule of the time steps where something happens (spread, yearly mortality, yearly output), so pest() can jump
+//from one event to the next instead of iterating (and loading weather for) every date of the simulation.
+
+// [[Rcpp::export]]
+DataFrame StepScheduleCpp(int start, int end, String time_step, bool seasonality, int s1, int s2, int output_month,
+                          bool mortality = false, int mortality_month = 1, int mortality_day = 1){
+
+  pops::ScheduleOptions opt;
+  opt.start_year = start;
+  opt.end_year = end;
+  opt.seasonality = seasonality;
+  opt.s1 = s1;
+  opt.s2 = s2;
+  opt.output_month = output_month;
+  opt.mortality = mortality;
+  opt.mortality_month = mortality_month;
+  opt.mortality_day = mortality_day;
+  try {
+    opt.unit = pops::step_unit(std::string(time_step.get_cstring()));
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  if (start > end) stop("start date must precede end date!!");
+
+  pops::Schedule schedule(opt);
+  const std::vector<pops::ScheduledStep>& ev = schedule.events();
+  int n = ev.size();
+  IntegerVector step(n), year(n);
+  CharacterVector date(n);
+  LogicalVector active(n), mort(n), output(n);
+  for (int i = 0; i < n; i++){
+    step[i] = ev[i].step;
+    year[i] = ev[i].date.year;
+    date[i] = pops::format_date(ev[i].date);
+    active[i] = ev[i].active;
+    mort[i] = ev[i].mortality;
+    output[i] = ev[i].output;
+  }
+
+  DataFrame out = DataFrame::create(_["step"] = step, _["date"] = date, _["year"] = year,
+                                    _["active"] = active, _["mortality"] = mort, _["output"] = output,
+                                    _["stringsAsFactors"] = false);
+  out.attr("n_steps") = schedule.n_steps();
+  return out;
+}
+
+//Asynchronous simulation jobs for the Shiny app: the native engine runs on a worker thread while the session polls
+//progress, reads downsampled frames and can cancel the run. All inputs (hosts, weather of the active steps,
+//critical temperature of each year) are copied in before the start since the worker cannot call back into R.
+//R matrices are column-major, the engine grids are row-major.
+
+template <typename T, typename M>
+std::vector<T> to_row_major(const M& mat){
+  int nrow = mat.nrow(), ncol = mat.ncol();
+  std::vector<T> out(std::size_t(nrow) * ncol);
+  for (int j = 0; j < ncol; j++)
+    for (int i = 0; i < nrow; i++)
+      out[std::size_t(i) * ncol + j] = mat(i, j);
+  return out;
+}
+
+IntegerMatrix from_row_major(const std::vector<int>& grid, int nrow, int ncol){
+  IntegerMatrix out(nrow, ncol);
+  for (int i = 0; i < nrow; i++)
+    for (int j = 0; j < ncol; j++)
+      out(i, j) = grid[std::size_t(i) * ncol + j];
+  return out;
+}
+
+typedef XPtr<pops::SimulationJob> SimJobPtr;
+
+// full schedule of a run (start to end) from the job config
+pops::Schedule job_schedule(List config){
+  pops::ScheduleOptions opt;
+  opt.start_year = as<int>(config["start"]);
+  opt.end_year = as<int>(config["end"]);
+  opt.seasonality = as<bool>(config["seasonality"]);
+  opt.s1 = as<int>(config["s1"]);
+  opt.s2 = as<int>(config["s2"]);
+  opt.output_month = as<int>(config["output_month"]);
+  opt.mortality = as<bool>(config["mortality"]);
+  opt.mortality_month = as<int>(config["mortality_month"]);
+  opt.mortality_day = as<int>(config["mortality_day"]);
+  opt.unit = pops::step_unit(as<std::string>(config["time_step"]));
+  return pops::Schedule(opt);
+}
+
+// first step of the children of a forked run (config$fork = year, month, day; integer(0) = no fork)
+int fork_step(List config, const pops::Schedule& schedule){
+  IntegerVector fork = config["fork"];
+  if (fork.size() == 0) return schedule.n_steps() + 1;
+  if (fork.size() != 3) stop("the fork date must be given as year, month, day");
+  pops::Date d = {fork[0], fork[1], fork[2]};
+  return schedule.step_at(d);
+}
+
+typedef std::shared_ptr<const pops::LandscapePack> LandscapePackRef;
+
+// host grids a job starts from (row-major)
+struct JobLandscape {
+  int nrow, ncol;
+  std::vector<std::vector<int> > S, I;
+  std::vector<int> all_trees;
+};
+
+// host grids from the matrices of pestJobStart, or from a landscape pack (LandscapePackCpp) when 'pack' is not NULL
+JobLandscape job_landscape(List S_list, List I_list, IntegerMatrix all_trees, int nhosts, SEXP pack){
+  JobLandscape land;
+  if (pack != R_NilValue){
+    XPtr<LandscapePackRef> ref(pack);
+    try {
+      (*ref)->initial_state(nhosts, land.S, land.I);
+    } catch (std::exception& e) {
+      stop(e.what());
+    }
+    land.nrow = (*ref)->nrow();
+    land.ncol = (*ref)->ncol();
+    land.all_trees = (*ref)->all_trees();
+    return land;
+  }
+  land.nrow = all_trees.nrow();
+  land.ncol = all_trees.ncol();
+  if (S_list.size() != nhosts || I_list.size() != nhosts) stop("S_list, I_list and host_score must have one entry per host");
+  for (int h = 0; h < nhosts; h++){
+    IntegerMatrix S_mat = as<IntegerMatrix>(S_list[h]);
+    IntegerMatrix I_mat = as<IntegerMatrix>(I_list[h]);
+    if (S_mat.nrow() != land.nrow || S_mat.ncol() != land.ncol || I_mat.nrow() != land.nrow || I_mat.ncol() != land.ncol)
+      stop("host matrices and all_trees must have the same dimensions");
+    land.S.push_back(to_row_major<int>(S_mat));
+    land.I.push_back(to_row_major<int>(I_mat));
+  }
+  land.all_trees = to_row_major<int>(all_trees);
+  return land;
+}
+
+typedef std::shared_ptr<const pops::ZoneIndex> ZoneIndexRef;
+
+// start a job on the hosts given (see pestJobStart), reading its weather from 'weather'
+SEXP start_job(List config, const JobLandscape& land, NumericVector host_score,
+               std::shared_ptr<pops::WeatherSource> weather){
+
+  std::vector<double> score;
+  for (int h = 0; h < host_score.size(); h++) score.push_back(host_score[h] / 10.0);
+  NumericVector lethal = config["lethal_temp"];
+
+  pops::JobOptions job_opt;
+  job_opt.frame_every = as<int>(config["frame_every"]);
+  job_opt.frame_max_dim = as<int>(config["frame_max_dim"]);
+  job_opt.frame_capacity = as<int>(config["frame_capacity"]);
+  job_opt.domains = as<int>(config["domains"]);
+  //zone indices (ZoneIndexCpp) summarized at every yearly output
+  if (config.containsElementNamed("zones")){
+    List zones = config["zones"];
+    for (int z = 0; z < zones.size(); z++){
+      SEXP zone = zones[z];
+      XPtr<ZoneIndexRef> ref(zone);
+      if ((*ref)->ncell() != std::size_t(land.nrow) * land.ncol) stop("the zone index does not have the grid of the hosts");
+      job_opt.zones.push_back(*ref);
+    }
+  }
+
+  pops::SpreadParams params;
+  params.res = as<double>(config["res"]);
+  params.spore_rate = as<double>(config["spore_rate"]);
+  params.seed = (uint64_t) as<double>(config["seed"]);
+  params.threads = config.containsElementNamed("threads") ? as<int>(config["threads"]) : 1;
+  params.concurrent_landing = config.containsElementNamed("concurrent_landing") && as<bool>(config["concurrent_landing"]);
+  params.aggregate_landings = config.containsElementNamed("aggregate_landings") && as<bool>(config["aggregate_landings"]);
+  params.common_random_numbers = config.containsElementNamed("common_random_numbers") && as<bool>(config["common_random_numbers"]);
+  params.antithetic = config.containsElementNamed("antithetic") && as<bool>(config["antithetic"]);
+
+  pops::SimulationJob* job = 0;
+  try {
+    // a run with a fork date stops before it; its children run the rest (SimJobForkCpp)
+    pops::Schedule schedule = job_schedule(config);
+    schedule = schedule.slice(1, fork_step(config, schedule) - 1);
+    params.kernel.type = pops::kernel_type(as<std::string>(config["kernelType"]));
+    params.kernel.scale1 = as<double>(config["scale1"]);
+    params.kernel.scale2 = as<double>(config["scale2"]);
+    params.kernel.gamma = as<double>(config["gamma"]);
+    params.kernel.shape = as<double>(config["shape"]);
+    params.kernel.wind = as<bool>(config["wind"]);
+    params.kernel.wind_dir = 0;
+    params.kernel.kappa = as<double>(config["kappa"]);
+    if (params.kernel.wind)
+      params.kernel.wind_dir = pops::wind_direction(as<std::string>(config["pwdir"])) * pops::pi / 180;
+    // discretized kernel, shared with the earlier runs of the session that used the same kernel
+    if (as<bool>(config["kernel_table"])) params.table = pops::kernel_cache().get(params.kernel, params.res);
+
+    std::unique_ptr<pops::Simulation> sim(new pops::Simulation(land.nrow, land.ncol, land.S, land.I, land.all_trees, score,
+                                                               std::vector<double>(lethal.begin(), lethal.end()), params));
+    job = new pops::SimulationJob(sim.get(), schedule, weather, job_opt);
+    sim.release();   // owned by the job
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+
+  // the finalizer deletes the job, which cancels and joins the worker
+  SimJobPtr ptr(job, true);
+  job->start();
+  return ptr;
+}
+
+// [[Rcpp::export]]
+SEXP SimJobStartCpp(List config, List S_list, List I_list, IntegerMatrix all_trees, NumericVector host_score,
+                    List weather, IntegerVector weather_steps, List crit_temp, IntegerVector crit_years,
+                    List wind_dir = List(), List wind_kappa = List(), IntegerVector wind_steps = IntegerVector(),
+                    SEXP pack = R_NilValue){
+
+  JobLandscape land = job_landscape(S_list, I_list, all_trees, host_score.size(), pack);
+  int nrow = land.nrow, ncol = land.ncol;
+  if (weather.size() != weather_steps.size()) stop("weather and weather_steps must have the same length");
+  if (crit_temp.size() != crit_years.size()) stop("crit_temp and crit_years must have the same length");
+  if (wind_dir.size() != wind_steps.size()) stop("wind_dir and wind_steps must have the same length");
+  if (wind_kappa.size() != 0 && wind_kappa.size() != wind_steps.size()) stop("wind_kappa must be empty or have one layer per wind step");
+
+  std::unique_ptr<pops::MemoryWeather> store(new pops::MemoryWeather());
+  for (int k = 0; k < weather.size(); k++){
+    NumericMatrix w = as<NumericMatrix>(weather[k]);
+    if (w.nrow() != nrow || w.ncol() != ncol) stop("weather layers and all_trees must have the same dimensions");
+    store->add_suitability(weather_steps[k], to_row_major<float>(w));
+  }
+  for (int k = 0; k < crit_temp.size(); k++){
+    NumericMatrix c = as<NumericMatrix>(crit_temp[k]);
+    if (c.nrow() != nrow || c.ncol() != ncol) stop("crit_temp layers and all_trees must have the same dimensions");
+    store->add_crit_temp(crit_years[k], to_row_major<float>(c));
+  }
+  //wind field per step: direction in degrees (NA = no prevailing direction), kappa optional (kappa of config if absent)
+  for (int k = 0; k < wind_dir.size(); k++){
+    NumericMatrix d = as<NumericMatrix>(wind_dir[k]);
+    if (d.nrow() != nrow || d.ncol() != ncol) stop("wind layers and all_trees must have the same dimensions");
+    std::vector<float> kappa;
+    if (wind_kappa.size() != 0){
+      NumericMatrix kp = as<NumericMatrix>(wind_kappa[k]);
+      if (kp.nrow() != nrow || kp.ncol() != ncol) stop("wind layers and all_trees must have the same dimensions");
+      kappa = to_row_major<float>(kp);
+    }
+    store->add_wind(wind_steps[k], to_row_major<float>(d), kappa);
+  }
+  return start_job(config, land, host_score, std::shared_ptr<pops::WeatherSource>(store.release()));
+}
+
+//Weather-year bank for future weather scenarios (replaces re-stacking the rasters of the sampled years in climGen):
+//each historical year is loaded once and shared read-only by all the jobs started from it.
+//layers: one list of matrices (weather suitability per step of the year) per year; ranked: years from the most to
+//the least favorable (WeatherRanked.csv).
+
+typedef std::shared_ptr<const pops::WeatherBank> WeatherBankRef;
+
+// [[Rcpp::export]]
+SEXP WeatherBankCpp(List layers, IntegerVector years, String time_step, IntegerVector ranked,
+                    List crit_temp, IntegerVector crit_years){
+  if (layers.size() != years.size()) stop("layers must hold one list of layers per year");
+  if (crit_temp.size() != crit_years.size()) stop("crit_temp and crit_years must have the same length");
+  if (layers.size() == 0) stop("the weather bank needs at least one year");
+  std::shared_ptr<pops::WeatherBank> bank;
+  try {
+    pops::StepUnit unit = pops::step_unit(std::string(time_step.get_cstring()));
+    for (int y = 0; y < layers.size(); y++){
+      List year_layers = as<List>(layers[y]);
+      for (int k = 0; k < year_layers.size(); k++){
+        NumericMatrix w = as<NumericMatrix>(year_layers[k]);
+        if (!bank) bank.reset(new pops::WeatherBank(std::size_t(w.nrow()) * w.ncol(), unit));
+        bank->add_layer(years[y], k, to_row_major<float>(w));
+      }
+    }
+    if (!bank) stop("the weather bank needs at least one layer");
+    for (int k = 0; k < crit_temp.size(); k++)
+      bank->add_crit_temp(crit_years[k], to_row_major<float>(as<NumericMatrix>(crit_temp[k])));
+    bank->set_ranking(std::vector<int>(ranked.begin(), ranked.end()));
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  return XPtr<WeatherBankRef>(new WeatherBankRef(bank), true);
+}
+
+//Historical year used for each simulated year start..end: years of the bank as they are, later years drawn from the
+//ranking ("random", "favorable" upper half, "unfavorable" lower half). 'replicate' gives each replicate its own draw.
+
+// [[Rcpp::export]]
+IntegerVector WeatherScenarioYearsCpp(SEXP bank, int start, int end, String scenario, double seed, int replicate = 0){
+  XPtr<WeatherBankRef> ref(bank);
+  std::vector<int> years;
+  try {
+    years = pops::scenario_years(**ref, start, end, pops::weather_scenario(std::string(scenario.get_cstring())),
+                                 (uint64_t) seed, (uint64_t) replicate);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  return IntegerVector(years.begin(), years.end());
+}
+
+// [[Rcpp::export]]
+SEXP SimJobStartBankCpp(List config, List S_list, List I_list, IntegerMatrix all_trees, NumericVector host_score,
+                        SEXP bank, IntegerVector scenario_years, SEXP pack = R_NilValue){
+  XPtr<WeatherBankRef> ref(bank);
+  JobLandscape land = job_landscape(S_list, I_list, all_trees, host_score.size(), pack);
+  if ((*ref)->ncell() != std::size_t(land.nrow) * land.ncol) stop("the weather bank and all_trees must have the same dimensions");
+  if (scenario_years.size() != as<int>(config["end"]) - as<int>(config["start"]) + 1) stop("scenario_years must give one year per simulated year");
+  std::shared_ptr<pops::WeatherSource> weather(
+    new pops::ScenarioWeather(*ref, as<int>(config["start"]), std::vector<int>(scenario_years.begin(), scenario_years.end())));
+  return start_job(config, land, host_score, weather);
+}
+
+//Landscape pack (see landscape_pack.h): host matrices, all_trees and the initial population (missing values set to 0)
+//written once to a binary file that later runs map instead of loading and converting the rasters. extent is
+//c(xmin, xmax, ymin, ymax) of the rasters.
+
+// [[Rcpp::export]]
+void LandscapePackWriteCpp(String path, List hosts, IntegerMatrix all_trees, IntegerMatrix initial,
+                           NumericVector extent, String crs){
+  if (extent.size() != 4) stop("extent must be c(xmin, xmax, ymin, ymax)");
+  int nrow = all_trees.nrow(), ncol = all_trees.ncol();
+  if (initial.nrow() != nrow || initial.ncol() != ncol) stop("host matrices and all_trees must have the same dimensions");
+  std::vector<std::vector<int> > grids;
+  for (int h = 0; h < hosts.size(); h++){
+    IntegerMatrix host = as<IntegerMatrix>(hosts[h]);
+    if (host.nrow() != nrow || host.ncol() != ncol) stop("host matrices and all_trees must have the same dimensions");
+    grids.push_back(to_row_major<int>(host));
+  }
+  pops::PackGeometry geometry = {extent[0], extent[1], extent[2], extent[3], std::string(crs.get_cstring())};
+  try {
+    pops::LandscapePack::write(std::string(path.get_cstring()), nrow, ncol, geometry, to_row_major<int>(all_trees),
+                               to_row_major<int>(initial), grids);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+}
+
+//Map a landscape pack (the checksum is checked unless verify = FALSE); the pointer is passed to SimJobStartCpp or
+//SimJobStartBankCpp in place of the host matrices.
+
+// [[Rcpp::export]]
+List LandscapePackCpp(String path, bool verify = true){
+  LandscapePackRef pack;
+  try {
+    pack.reset(new pops::LandscapePack(std::string(path.get_cstring()), verify));
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  pops::PackGeometry g = pack->geometry();
+  char checksum[17];
+  std::snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long) pack->checksum());
+  return List::create(
+    _["ptr"] = XPtr<LandscapePackRef>(new LandscapePackRef(pack), true),
+    _["nrow"] = pack->nrow(),
+    _["ncol"] = pack->ncol(),
+    _["nhosts"] = pack->nhosts(),
+    _["extent"] = NumericVector::create(g.xmin, g.xmax, g.ymin, g.ymax),
+    _["crs"] = g.crs,
+    _["checksum"] = std::string(checksum)
+  );
+}
+
+//Child of a finished job started with a fork date: continues from its final state up to the end of the run on its
+//own random stream (stream 0 = the stream of the parent). The host grids are shared with the parent until the child
+//writes to them. Without a bank the child uses the weather of the parent; with a bank, the scenario_years given.
+
+// [[Rcpp::export]]
+SEXP SimJobForkCpp(SEXP parent, List config, double stream, SEXP bank = R_NilValue,
+                   IntegerVector scenario_years = IntegerVector()){
+  SimJobPtr ptr(parent);
+  if (!ptr->finished()) stop("the parent job is still running");
+  ptr->join();
+  std::shared_ptr<pops::WeatherSource> weather;
+  if (bank != R_NilValue){
+    XPtr<WeatherBankRef> ref(bank);
+    if (scenario_years.size() != as<int>(config["end"]) - as<int>(config["start"]) + 1) stop("scenario_years must give one year per simulated year");
+    weather.reset(new pops::ScenarioWeather(*ref, as<int>(config["start"]), std::vector<int>(scenario_years.begin(), scenario_years.end())));
+  }
+  pops::SimulationJob* job = 0;
+  try {
+    pops::Schedule schedule = job_schedule(config);
+    job = ptr->fork(schedule.slice(fork_step(config, schedule), schedule.n_steps()), (uint64_t) stream, weather);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  SimJobPtr child(job, true);
+  job->start();
+  return child;
+}
+
+// [[Rcpp::export]]
+List SimJobProgressCpp(SEXP job){
+  SimJobPtr ptr(job);
+  pops::JobProgress p = ptr->progress();
+  return List::create(
+    _["status"] = std::string(pops::job_status_name(p.status)),
+    _["done"] = p.done,
+    _["total"] = p.total,
+    _["step"] = p.step,
+    _["date"] = p.done > 0 ? pops::format_date(p.date) : std::string(),
+    _["infected"] = NumericVector(p.infected.begin(), p.infected.end()),
+    _["infected_cells"] = (double) p.infected_cells,
+    _["error"] = p.error
+  );
+}
+
+// [[Rcpp::export]]
+bool SimJobCancelCpp(SEXP job){
+  SimJobPtr ptr(job);
+  ptr->cancel();
+  return !ptr->finished();
+}
+
+//Frames newer than sequence number 'since'; each frame is the sum of infected hosts aggregated over
+//'factor' x 'factor' blocks of cells.
+
+// [[Rcpp::export]]
+List SimJobFramesCpp(SEXP job, double since = 0){
+  SimJobPtr ptr(job);
+  std::vector<pops::Frame> frames = ptr->frames((long) since);
+  List out(frames.size());
+  for (std::size_t k = 0; k < frames.size(); k++){
+    const pops::Frame& f = frames[k];
+    out[k] = List::create(
+      _["seq"] = (double) f.seq,
+      _["step"] = f.step,
+      _["date"] = pops::format_date(f.date),
+      _["factor"] = f.factor,
+      _["infected"] = from_row_major(f.values, f.nrow, f.ncol)
+    );
+  }
+  return out;
+}
+
+// yearly outputs of a finished job, those of its parent jobs first
+std::vector<const pops::YearlyOutput*> job_outputs(const pops::SimulationJob& job){
+  std::vector<const pops::YearlyOutput*> outputs;
+  for (std::size_t k = 0; k < job.prefix().size(); k++) outputs.push_back(&job.prefix()[k]);
+  for (std::size_t k = 0; k < job.outputs().size(); k++) outputs.push_back(&job.outputs()[k]);
+  return outputs;
+}
+
+//Results of a finished job: yearly infected hosts per host (those of the parent jobs first for a forked job) plus the
+//final S and I matrices. The window of each year is the part of the grid the run used so far (rows and columns from 1,
+//NA before any spread step). The yearly layers are matrices, or with sparse = TRUE the compressed layers of the engine
+//(raw vectors, see sparse_output.h) to be expanded with SparseLayerCpp for the years that are looked at.
+
+// [[Rcpp::export]]
+List SimJobResultCpp(SEXP job, bool sparse = false){
+  SimJobPtr ptr(job);
+  if (!ptr->finished()) stop("the simulation job is still running");
+  ptr->join();
+  pops::JobProgress p = ptr->progress();
+  if (p.status == pops::JOB_ERROR) stop(p.error);
+
+  const pops::Simulation& sim = ptr->simulation();
+  std::vector<const pops::YearlyOutput*> outputs = job_outputs(*ptr);
+  int nrow = sim.nrow(), ncol = sim.ncol();
+
+  IntegerVector years(outputs.size()), steps(outputs.size());
+  List yearly(outputs.size());
+  for (std::size_t k = 0; k < outputs.size(); k++){
+    years[k] = outputs[k]->year;
+    steps[k] = outputs[k]->step;
+    List hosts(sim.nhosts());
+    NumericVector infected(sim.nhosts()), area(sim.nhosts());
+    for (int h = 0; h < sim.nhosts(); h++){
+      const pops::SparseLayer& layer = outputs[k]->I[h];
+      if (sparse) hosts[h] = RawVector(layer.bytes().begin(), layer.bytes().end());
+      else hosts[h] = from_row_major(layer.dense(), nrow, ncol);
+      infected[h] = layer.total();
+      area[h] = layer.cells();
+    }
+    List zonal(outputs[k]->zonal.size());
+    for (std::size_t z = 0; z < outputs[k]->zonal.size(); z++){
+      const pops::ZonalSummary& summary = outputs[k]->zonal[z];
+      NumericMatrix zone_hosts(summary.nzones, summary.nhosts);
+      NumericVector zone_cells(summary.nzones);
+      for (int zone = 1; zone <= summary.nzones; zone++){
+        for (int h = 0; h < summary.nhosts; h++) zone_hosts(zone - 1, h) = summary.infected(zone, h);
+        zone_cells[zone - 1] = summary.infected_cells(zone);
+      }
+      zonal[z] = List::create(_["infected"] = zone_hosts, _["infected_area"] = zone_cells);
+    }
+    const pops::Window& w = outputs[k]->window;
+    IntegerVector window = w.empty() ? IntegerVector(4, NA_INTEGER) : IntegerVector::create(w.row0 + 1, w.row1, w.col0 + 1, w.col1);
+    yearly[k] = List::create(_["I"] = hosts, _["infected"] = infected, _["infected_area"] = area, _["zonal"] = zonal,
+                             _["window"] = window);
+  }
+  List S_out(sim.nhosts()), I_out(sim.nhosts());
+  for (int h = 0; h < sim.nhosts(); h++){
+    S_out[h] = from_row_major(sim.susceptible(h), nrow, ncol);
+    I_out[h] = from_row_major(sim.infected(h), nrow, ncol);
+  }
+  return List::create(
+    _["status"] = std::string(pops::job_status_name(p.status)),
+    _["years"] = years,
+    _["steps"] = steps,
+    _["nrow"] = nrow,
+    _["ncol"] = ncol,
+    _["yearly"] = yearly,
+    _["S"] = S_out,
+    _["I"] = I_out
+  );
+}
+
+//Expand compressed yearly layers (SimJobResultCpp with sparse = TRUE) of an nrow x ncol grid: the infected hosts summed
+//over the layers given, NA where there are none (as in the rasters returned by pest()).
+
+// [[Rcpp::export]]
+NumericMatrix SparseLayerCpp(List layers, int nrow, int ncol){
+  std::vector<int> grid(std::size_t(nrow) * ncol, 0);
+  try {
+    for (int k = 0; k < layers.size(); k++){
+      RawVector raw = as<RawVector>(layers[k]);
+      pops::SparseLayer layer = pops::SparseLayer::decode_bytes(std::vector<unsigned char>(raw.begin(), raw.end()), grid.size());
+      layer.for_each([&grid](long cell, int value){ grid[cell] += value; });
+    }
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  NumericMatrix out(nrow, ncol);
+  for (int i = 0; i < nrow; i++)
+    for (int j = 0; j < ncol; j++){
+      int v = grid[std::size_t(i) * ncol + j];
+      out(i, j) = v > 0 ? double(v) : NA_REAL;
+    }
+  return out;
+}
+
+//Ensembles summarized online (see ensemble.h): replicates are added as they finish and only per-cell and per-year
+//running statistics are kept. A cell counts as infected with more than 'threshold' infected hosts (all hosts summed);
+//'probs' are the quantiles reported for the yearly infected area and infected hosts.
+
+// [[Rcpp::export]]
+SEXP EnsembleCpp(int nrow, int ncol, IntegerVector years, NumericVector probs, int threshold = 0){
+  try {
+    pops::Ensemble* ensemble = new pops::Ensemble(std::size_t(nrow) * ncol, as<std::vector<int> >(years),
+                                                  as<std::vector<double> >(probs), threshold);
+    return XPtr<pops::Ensemble>(ensemble, true);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+}
+
+//Add a finished job (with the outputs of its parent jobs for a forked job) as one replicate. release = TRUE frees the
+//job right away, so a long ensemble holds at most the jobs that are running. Returns the number of replicates.
+
+// [[Rcpp::export]]
+int EnsembleAddCpp(SEXP ensemble, SEXP job, bool release = true){
+  XPtr<pops::Ensemble> ens(ensemble);
+  SimJobPtr ptr(job);
+  if (!ptr->finished()) stop("the simulation job is still running");
+  ptr->join();
+  pops::JobProgress p = ptr->progress();
+  if (p.status == pops::JOB_ERROR) stop(p.error);
+  if (p.status != pops::JOB_DONE) stop(std::string("only a job that ran to completion can be added to an ensemble (status: ") +
+                                       pops::job_status_name(p.status) + ")");
+  try {
+    ens->add(job_outputs(*ptr));
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  if (release) ptr.release();
+  return (int) ens->replicates();
+}
+
+//Summary of an ensemble: per output year the probability of infection, mean and variance of infected hosts per cell
+//(NA where no replicate had infected hosts) and the mean, standard deviation and quantiles of the infected area (cells)
+//and infected hosts.
+
+// [[Rcpp::export]]
+List EnsembleResultCpp(SEXP ensemble, int nrow, int ncol){
+  XPtr<pops::Ensemble> ens(ensemble);
+  if (std::size_t(nrow) * ncol != ens->ncell()) stop("nrow x ncol does not match the grid of the ensemble");
+  const std::vector<int>& years = ens->years();
+  int nyears = years.size();
+  int nprobs = ens->totals(0).area_q.size();
+  List probability(nyears), mean(nyears), variance(nyears);
+  NumericVector area_mean(nyears), area_sd(nyears), hosts_mean(nyears), hosts_sd(nyears), probs(nprobs);
+  NumericMatrix area_q(nyears, nprobs), hosts_q(nyears, nprobs);
+  for (int k = 0; k < nyears; k++){
+    NumericMatrix p(nrow, ncol), m(nrow, ncol), v(nrow, ncol);
+    std::fill(p.begin(), p.end(), NA_REAL);
+    std::fill(m.begin(), m.end(), NA_REAL);
+    std::fill(v.begin(), v.end(), NA_REAL);
+    ens->for_each(k, [&](int cell, double prob, double mu, double var){
+      int i = cell / ncol, j = cell % ncol;
+      p(i, j) = prob;
+      m(i, j) = mu;
+      v(i, j) = std::isnan(var) ? NA_REAL : var;
+    });
+    probability[k] = p;
+    mean[k] = m;
+    variance[k] = v;
+    const pops::EnsembleTotals& t = ens->totals(k);
+    area_mean[k] = t.area.mean();
+    area_sd[k] = std::sqrt(t.area.variance());
+    hosts_mean[k] = t.hosts.mean();
+    hosts_sd[k] = std::sqrt(t.hosts.variance());
+    for (int i = 0; i < nprobs; i++){
+      probs[i] = t.area_q[i].probability();
+      area_q(k, i) = t.area_q[i].value();
+      hosts_q(k, i) = t.hosts_q[i].value();
+    }
+  }
+  return List::create(
+    _["replicates"] = (double) ens->replicates(),
+    _["years"] = IntegerVector(years.begin(), years.end()),
+    _["threshold"] = ens->threshold(),
+    _["cells"] = (double) ens->cells(),
+    _["probability"] = probability,
+    _["mean"] = mean,
+    _["variance"] = variance,
+    _["probs"] = probs,
+    _["area_mean"] = area_mean,
+    _["area_sd"] = area_sd,
+    _["area_q"] = area_q,
+    _["hosts_mean"] = hosts_mean,
+    _["hosts_sd"] = hosts_sd,
+    _["hosts_q"] = hosts_q
+  );
+}
+
+//Observations to compare runs with (see comparison.h), preprocessed once and reused by every run of a calibration: an
+//observed raster as a matrix (NA = not surveyed), or survey points given by their row and column in the grid (NA =
+//outside) and observed value (> 0 = infected).
+
+// [[Rcpp::export]]
+SEXP ObservationGridCpp(NumericMatrix observed){
+  try {
+    pops::Observation obs = pops::Observation::grid(observed.nrow(), observed.ncol(), to_row_major<float>(observed));
+    return XPtr<pops::Observation>(new pops::Observation(obs), true);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+}
+
+// [[Rcpp::export]]
+SEXP ObservationPointsCpp(int nrow, int ncol, IntegerVector rows, IntegerVector cols, NumericVector values){
+  if (rows.size() != cols.size()) stop("rows and cols must have the same length");
+  std::vector<int> cells(rows.size());
+  for (int k = 0; k < rows.size(); k++){
+    bool inside = rows[k] != NA_INTEGER && cols[k] != NA_INTEGER && rows[k] >= 1 && rows[k] <= nrow && cols[k] >= 1 && cols[k] <= ncol;
+    cells[k] = inside ? (rows[k] - 1) * ncol + (cols[k] - 1) : -1;
+  }
+  try {
+    pops::Observation obs = pops::Observation::points(nrow, ncol, cells, as<std::vector<float> >(values));
+    return XPtr<pops::Observation>(new pops::Observation(obs), true);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+}
+
+//Comparison of the yearly outputs of a finished job with one observation per year: confusion matrix, kappa, quantity
+//and allocation disagreement, RMSE of infected counts and distances (in cells) between simulated and observed
+//infections. A simulated cell is infected with more than 'threshold' infected hosts, all hosts summed.
+
+// [[Rcpp::export]]
+DataFrame SimJobCompareCpp(SEXP job, IntegerVector years, List observations, int threshold = 0){
+  SimJobPtr ptr(job);
+  if (!ptr->finished()) stop("the simulation job is still running");
+  ptr->join();
+  pops::JobProgress p = ptr->progress();
+  if (p.status == pops::JOB_ERROR) stop(p.error);
+  if (observations.size() != years.size()) stop("one observation per year is needed");
+  std::vector<const pops::YearlyOutput*> outputs = job_outputs(*ptr);
+  const pops::Simulation& sim = ptr->simulation();
+
+  int n = years.size();
+  NumericVector tp(n), fp(n), fn(n), tn(n), kappa(n), quantity(n), allocation(n), rmse(n),
+    sim_mean(n), sim_max(n), obs_mean(n), obs_max(n);
+  for (int k = 0; k < n; k++){
+    const pops::YearlyOutput* out = 0;
+    for (std::size_t o = 0; o < outputs.size(); o++)
+      if (outputs[o]->year == years[k]) out = outputs[o];
+    if (!out) stop("the job has no output for year " + std::to_string(years[k]));
+    SEXP observation = observations[k];
+    XPtr<pops::Observation> obs(observation);
+    if (obs->nrow() != sim.nrow() || obs->ncol() != sim.ncol()) stop("the observation does not have the grid of the simulation");
+    pops::Comparison c = pops::compare(pops::sum_layers(out->I), *obs, threshold);
+    tp[k] = c.tp;
+    fp[k] = c.fp;
+    fn[k] = c.fn;
+    tn[k] = c.tn;
+    kappa[k] = c.kappa;
+    quantity[k] = c.quantity;
+    allocation[k] = c.allocation;
+    rmse[k] = c.rmse;
+    sim_mean[k] = c.sim_to_obs_mean;
+    sim_max[k] = c.sim_to_obs_max;
+    obs_mean[k] = c.obs_to_sim_mean;
+    obs_max[k] = c.obs_to_sim_max;
+  }
+  return DataFrame::create(_["years"] = years, _["tp"] = tp, _["fp"] = fp, _["fn"] = fn, _["tn"] = tn,
+                           _["kappa"] = kappa, _["quantity"] = quantity, _["allocation"] = allocation, _["rmse"] = rmse,
+                           _["sim_to_obs_mean"] = sim_mean, _["sim_to_obs_max"] = sim_max,
+                           _["obs_to_sim_mean"] = obs_mean, _["obs_to_sim_max"] = obs_max);
+}
+
+//Gaussian-process emulator of a calibration metric (see emulator.h). Points are the rows of a matrix with one column
+//per parameter, scaled to [0, 1]; the metric is minimized.
+
+NumericMatrix emulator_points(const std::vector<double>& x, int dims){
+  int n = x.size() / dims;
+  NumericMatrix out(n, dims);
+  for (int i = 0; i < n; i++)
+    for (int d = 0; d < dims; d++) out(i, d) = x[std::size_t(i) * dims + d];
+  return out;
+}
+
+// [[Rcpp::export]]
+SEXP EmulatorCpp(int dims){
+  try {
+    return XPtr<pops::Emulator>(new pops::Emulator(dims), true);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+}
+
+//Latin hypercube of n points, the first design of a calibration.
+
+// [[Rcpp::export]]
+NumericMatrix LatinHypercubeCpp(int n, int dims, double seed = 42){
+  return emulator_points(pops::latin_hypercube(n, dims, uint64_t(seed)), dims);
+}
+
+//Add points run and their metric, and refit the length scales and nugget. Returns the fit.
+
+// [[Rcpp::export]]
+List EmulatorAddCpp(SEXP emulator, NumericMatrix x, NumericVector y){
+  XPtr<pops::Emulator> em(emulator);
+  if (x.ncol() != em->dims()) stop("the points need one column per parameter of the emulator");
+  if (x.nrow() != y.size()) stop("one metric per point is needed");
+  try {
+    std::vector<double> point(em->dims());
+    for (int i = 0; i < x.nrow(); i++){
+      for (int d = 0; d < em->dims(); d++) point[d] = x(i, d);
+      em->add(&point[0], y[i]);
+    }
+    em->fit();
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  NumericVector scales(em->dims());
+  for (int d = 0; d < em->dims(); d++) scales[d] = em->length_scale(d);
+  return List::create(_["points"] = (int) em->size(), _["length_scales"] = scales, _["nugget"] = em->nugget(),
+                      _["noise_sd"] = em->noise_sd(), _["incumbent"] = em->incumbent(),
+                      _["neg_log_likelihood"] = em->neg_log_likelihood());
+}
+
+//Posterior mean and standard deviation of the metric, and expected improvement, at the rows of x.
+
+// [[Rcpp::export]]
+DataFrame EmulatorPredictCpp(SEXP emulator, NumericMatrix x){
+  XPtr<pops::Emulator> em(emulator);
+  if (!em->fitted()) stop("the emulator has no points yet");
+  if (x.ncol() != em->dims()) stop("the points need one column per parameter of the emulator");
+  NumericVector mean(x.nrow()), sd(x.nrow()), improvement(x.nrow());
+  std::vector<double> point(em->dims());
+  for (int i = 0; i < x.nrow(); i++){
+    for (int d = 0; d < em->dims(); d++) point[d] = x(i, d);
+    pops::EmulatorPrediction p = em->predict(&point[0]);
+    mean[i] = p.mean;
+    sd[i] = p.sd;
+    improvement[i] = em->expected_improvement(&point[0]);
+  }
+  return DataFrame::create(_["mean"] = mean, _["sd"] = sd, _["improvement"] = improvement);
+}
+
+//Next batch of points to run, by expected improvement among 'candidates' random points.
+
+// [[Rcpp::export]]
+List EmulatorProposeCpp(SEXP emulator, int batch, int candidates = 2000, double seed = 42){
+  XPtr<pops::Emulator> em(emulator);
+  if (!em->fitted()) stop("the emulator has no points yet");
+  std::vector<double> improvement, x;
+  try {
+    x = em->propose(batch, candidates, uint64_t(seed), improvement);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  return List::create(_["points"] = emulator_points(x, em->dims()), _["improvement"] = wrap(improvement));
+}
+
+//Point of lowest posterior mean among the points run and 'candidates' random points.
+
+// [[Rcpp::export]]
+List EmulatorOptimumCpp(SEXP emulator, int candidates = 2000, double seed = 42){
+  XPtr<pops::Emulator> em(emulator);
+  if (!em->fitted()) stop("the emulator has no points yet");
+  pops::EmulatorPrediction at;
+  std::vector<double> x = em->optimum(candidates, uint64_t(seed), at);
+  return List::create(_["point"] = wrap(x), _["mean"] = at.mean, _["sd"] = at.sd);
+}
+
+//Zone index (see zones.h): polygons (states, counties) rasterized once onto the grid of the runs, 0 outside every zone
+//and 1..nzones inside. The pointer goes into config$zones of a job, which then sums the infection per zone at every
+//yearly output. Returns the pointer and the cells of each zone.
+
+// [[Rcpp::export]]
+List ZoneIndexCpp(IntegerMatrix zones, int nzones){
+  ZoneIndexRef index;
+  try {
+    index.reset(new pops::ZoneIndex(to_row_major<int>(zones), nzones));
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  NumericVector cells(nzones);
+  for (int z = 1; z <= nzones; z++) cells[z - 1] = index->zone_cells(z);
+  return List::create(_["ptr"] = XPtr<ZoneIndexRef>(new ZoneIndexRef(index), true), _["cells"] = cells);
+}
+
+//Sum and number of cells with a value > 0 per zone of a matrix on the grid of a zone index (NA skipped), for rasters
+//that did not come out of a job.
+
+// [[Rcpp::export]]
+List ZonalSumCpp(SEXP index, NumericMatrix values){
+  XPtr<ZoneIndexRef> ref(index);
+  const pops::ZoneIndex& zones = **ref;
+  int nrow = values.nrow(), ncol = values.ncol();
+  if (std::size_t(nrow) * ncol != zones.ncell()) stop("the matrix does not have the grid of the zone index");
+  NumericVector sum(zones.nzones()), cells(zones.nzones());
+  for (int i = 0; i < nrow; i++)
+    for (int j = 0; j < ncol; j++){
+      double v = values(i, j);
+      int z = zones.zone(std::size_t(i) * ncol + j);
+      if (z == 0 || ISNAN(v)) continue;
+      sum[z - 1] += v;
+      if (v > 0) cells[z - 1]++;
+    }
+  return List::create(_["sum"] = sum, _["cells"] = cells);
+}
+
+//Dispersal kernels of the native engine (kernelType values) and the parameters each one uses besides scale1.
+
+// [[Rcpp::export]]
+DataFrame KernelTypesCpp(){
+  int n;
+  const pops::KernelInfo* kernels = pops::kernel_registry(n);
+  CharacterVector name(n);
+  LogicalVector scale2(n), gamma(n), shape(n);
+  for (int i = 0; i < n; i++){
+    name[i] = kernels[i].name;
+    scale2[i] = kernels[i].scale2;
+    gamma[i] = kernels[i].gamma;
+    shape[i] = kernels[i].shape;
+  }
+  return DataFrame::create(_["kernelType"] = name, _["scale2"] = scale2, _["gamma"] = gamma, _["shape"] = shape,
+                           _["stringsAsFactors"] = false);
+}
+
+//Kernel tables cached in this session (see kernel_table.h): number of tables kept, runs that reused one and runs
+//that had to build one. clear = TRUE empties the cache.
+
+// [[Rcpp::export]]
+List KernelCacheCpp(bool clear = false){
+  if (clear) pops::kernel_cache().clear();
+  pops::KernelCacheStats s = pops::kernel_cache().stats();
+  return List::create(_["tables"] = (int) s.tables, _["hits"] = (double) s.hits, _["misses"] = (double) s.misses);
+}
+
+//Weather coefficients from daily Daymet layers in one streaming pass (replaces the stack/overlay/stackApply pipeline
+//of weather_coeff). R reads the daily layers a year at a time and feeds them in date order; every finished
+//week/month comes back as a coefficient matrix and can be written out right away. Layers keep the R layout.
+
+struct WeatherCoeffState {
+  pops::StepUnit unit;
+  int start;
+  int nrow, ncol;
+  std::unique_ptr<pops::CoefficientAccumulator> prcp, temp;
+};
+
+pops::CoefficientMethod coefficient_method(List config, std::string prefix){
+  pops::CoefficientMethod m = pops::coefficient_method(as<std::string>(config[prefix + "_method"]));
+  m.thresh = as<double>(config[prefix + "_thresh"]);
+  m.a0 = as<double>(config[prefix + "_a0"]);
+  m.a1 = as<double>(config[prefix + "_a1"]);
+  m.a2 = as<double>(config[prefix + "_a2"]);
+  m.a3 = as<double>(config[prefix + "_a3"]);
+  m.x1mod = as<double>(config[prefix + "_x1mod"]);
+  m.x2mod = as<double>(config[prefix + "_x2mod"]);
+  m.x3mod = as<double>(config[prefix + "_x3mod"]);
+  return m;
+}
+
+// [[Rcpp::export]]
+SEXP WeatherCoeffStartCpp(List config, LogicalMatrix mask){
+  WeatherCoeffState* state = new WeatherCoeffState();
+  state->nrow = mask.nrow();
+  state->ncol = mask.ncol();
+  state->start = as<int>(config["start"]);
+  std::vector<char> cells(mask.begin(), mask.end());
+  try {
+    state->unit = pops::step_unit(as<std::string>(config["time_step"]));
+    if (as<bool>(config["prcp"]))
+      state->prcp.reset(new pops::CoefficientAccumulator(cells.size(), coefficient_method(config, "prcp"), cells));
+    if (as<bool>(config["temp"]))
+      state->temp.reset(new pops::CoefficientAccumulator(cells.size(), coefficient_method(config, "temp"), cells));
+  } catch (std::exception& e) {
+    delete state;
+    stop(e.what());
+  }
+  return XPtr<WeatherCoeffState>(state, true);
+}
+
+void add_period(std::vector<float>& grid, long period, int nrow, int ncol, List& out, IntegerVector& periods){
+  NumericMatrix m(nrow, ncol);
+  for (std::size_t cell = 0; cell < grid.size(); cell++) m[cell] = grid[cell];
+  out.push_back(m);
+  periods.push_back(int(period) + 1);
+}
+
+//Add the daily layers of a chunk of days (arrays nrow x ncol x ndays, numeric(0) for a variable that is not used).
+//Returns the periods completed by these days: step numbers and coefficient matrices.
+
+// [[Rcpp::export]]
+List WeatherCoeffAddCpp(SEXP state_ptr, IntegerVector year, IntegerVector month, IntegerVector day,
+                        NumericVector prcp, NumericVector tmin, NumericVector tmax){
+  XPtr<WeatherCoeffState> state(state_ptr);
+  std::size_t ncell = std::size_t(state->nrow) * state->ncol;
+  int ndays = year.size();
+  if (state->prcp && prcp.size() != int(ncell * ndays)) stop("prcp must hold one layer per day");
+  if (state->temp && (tmin.size() != int(ncell * ndays) || tmax.size() != int(ncell * ndays)))
+    stop("tmin and tmax must hold one layer per day");
+
+  List prcp_out, temp_out;
+  IntegerVector prcp_steps, temp_steps;
+  std::vector<float> finished;
+  std::vector<double> tavg(state->temp ? ncell : 0);
+  long period_done;
+  try {
+    for (int d = 0; d < ndays; d++){
+      pops::Date date = {year[d], month[d], day[d]};
+      long period = pops::period_index(state->unit, state->start, date);
+      if (state->prcp && state->prcp->add(period, prcp.begin() + d * ncell, finished, period_done))
+        add_period(finished, period_done, state->nrow, state->ncol, prcp_out, prcp_steps);
+      if (state->temp){
+        const double* lo = tmin.begin() + d * ncell;
+        const double* hi = tmax.begin() + d * ncell;
+        for (std::size_t cell = 0; cell < ncell; cell++) tavg[cell] = (lo[cell] + hi[cell]) / 2;
+        if (state->temp->add(period, &tavg[0], finished, period_done))
+          add_period(finished, period_done, state->nrow, state->ncol, temp_out, temp_steps);
+      }
+    }
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  return List::create(_["prcp_steps"] = prcp_steps, _["prcp"] = prcp_out,
+                      _["temp_steps"] = temp_steps, _["temp"] = temp_out);
+}
+
+//Coefficients of the last (current) period, to be called once after the last day.
+
+// [[Rcpp::export]]
+List WeatherCoeffFinishCpp(SEXP state_ptr){
+  XPtr<WeatherCoeffState> state(state_ptr);
+  List prcp_out, temp_out;
+  IntegerVector prcp_steps, temp_steps;
+  std::vector<float> finished;
+  long period_done;
+  if (state->prcp && state->prcp->flush(finished, period_done))
+    add_period(finished, period_done, state->nrow, state->ncol, prcp_out, prcp_steps);
+  if (state->temp && state->temp->flush(finished, period_done))
+    add_period(finished, period_done, state->nrow, state->ncol, temp_out, temp_steps);
+  return List::create(_["prcp_steps"] = prcp_steps, _["prcp"] = prcp_out,
+                      _["temp_steps"] = temp_steps, _["temp"] = temp_out);
+}
+
+//Weather ranking over M/C coefficient archives (replaces the raster loops of weatherRanking.r): weeks are streamed
+//one at a time and summed natively; zones (0 = not counted, 1..nregions) give per-region totals and rankings.
+
+// [[Rcpp::export]]
+SEXP WeatherRankStartCpp(int nrow, int ncol, IntegerVector zones = IntegerVector(), int nregions = 1){
+  pops::WeatherRanking* ranking = 0;
+  try {
+    ranking = new pops::WeatherRanking(std::size_t(nrow) * ncol, std::vector<int>(zones.begin(), zones.end()), nregions);
+  } catch (std::exception& e) {
+    stop(e.what());
+  }
+  return XPtr<pops::WeatherRanking>(ranking, true);
+}
+
+// [[Rcpp::export]]
+void WeatherRankAddCpp(SEXP ranking_ptr, int year, NumericMatrix M, NumericMatrix C){
+  XPtr<pops::WeatherRanking> ranking(ranking_ptr);
+  if (M.nrow() != C.nrow() || M.ncol() != C.ncol()) stop("M and C layers must have the same dimensions");
+  if (std::size_t(M.nrow()) * M.ncol() != ranking->ncell()) stop("M and C layers must have the cells of the ranking");
+  ranking->add_week(year, M.begin(), C.begin());
+}
+
+//weekly totals and the ranking table (year, values, rank as in WeatherRanked.csv, plus the region)
+
+// [[Rcpp::export]]
+List WeatherRankTableCpp(SEXP ranking_ptr){
+  XPtr<pops::WeatherRanking> ranking(ranking_ptr);
+  const std::vector<pops::WeekTotal>& weekly = ranking->weekly();
+  int nw = weekly.size();
+  IntegerVector w_year(nw), w_week(nw), w_region(nw);
+  NumericVector w_total(nw);
+  for (int k = 0; k < nw; k++){
+    w_year[k] = weekly[k].year;
+    w_week[k] = weekly[k].week;
+    w_region[k] = weekly[k].region;
+    w_total[k] = weekly[k].total;
+  }
+  std::vector<pops::YearRank> ranked = ranking->ranking();
+  int ny = ranked.size();
+  IntegerVector year(ny), rank(ny), region(ny);
+  NumericVector values(ny);
+  for (int k = 0; k < ny; k++){
+    year[k] = ranked[k].year;
+    values[k] = ranked[k].value;
+    rank[k] = ranked[k].rank;
+    region[k] = ranked[k].region;
+  }
+  return List::create(
+    _["weekly"] = DataFrame::create(_["year"] = w_year, _["week"] = w_week, _["region"] = w_region, _["total"] = w_total),
+    _["ranking"] = DataFrame::create(_["year"] = year, _["values"] = values, _["rank"] = rank, _["region"] = region)
+  );
+}
+
+//How these kernels were built and what the CPU running them supports (OpenMP, threads, instruction set assumed by the
+//build, run-time dispatch of the grid loops); cpu_ok is FALSE when the build needs instructions the CPU lacks.
+
+// [[Rcpp::export]]
+List EngineBuildInfoCpp(){
+  pops::BuildInfo info = pops::build_info();
+  return List::create(
+    _["openmp"] = info.openmp,
+    _["threads"] = info.threads,
+    _["isa"] = info.isa,
+    _["multiversion"] = info.multiversion,
+    _["cpu_avx2"] = info.cpu_avx2,
+    _["cpu_ok"] = info.cpu_ok
+  );
+}
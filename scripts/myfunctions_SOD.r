@@ -704,4 +704,165 @@ climGen <- function(ls, start, end, Wrank, scn=NA){
   
 }
 
+#weather-year bank for future weather scenarios: the weather layers of every historical year are read once (files in ls
+#are matched to years by name, as in climGen) and kept by the native engine, so every scenario and replicate started
+#from the bank (pestJobStart(weather_bank = ...)) references the years it needs instead of re-stacking the rasters
+weatherBank <- function(ls, years, Wrank, time_step = "weeks", critTempData = NULL){
+  
+  loadEngine()
+  layers <- lapply(years, FUN=function(x){
+    files <- sort(grep(as.character(x), ls, value=TRUE))
+    if (length(files) == 0) stop(paste('no weather files found for year', x))
+    l <- unlist(lapply(files, FUN=function(f){ s <- stack(f); lapply(1:nlayers(s), function(i) as.matrix(s[[i]])) }), recursive = FALSE)
+    lapply(l, FUN=function(w){ w[is.na(w)] <- 0; w })
+  })
+  crit_temp <- list()
+  crit_years <- integer(0)
+  if (!is.null(critTempData)){
+    crit_years <- as.integer(years)
+    crit_temp <- lapply(seq_along(years), FUN=function(i) critTempLayer(critTempData, i))
+  }
+  ranked <- Wrank[order(Wrank[,"rank"]), 1]
+  WeatherBankCpp(layers, as.integer(years), time_step, as.integer(ranked[ranked %in% years]), crit_temp, crit_years)
+  
+}
+
+#historical year standing for each simulated year of a future weather scenario ('random', 'favorable' or
+#'unfavorable', as in climGen); replicates with the same seed get different draws
+climGenYears <- function(bank, start, end, scn = NA, seed = 42, replicate = 0){
+  
+  WeatherScenarioYearsCpp(bank, start, end, ifelse(is.na(scn), "none", scn), seed, replicate)
+  
+}
+
+#read the layer of a single time step from a weather coefficient file (missing values are set to 0), so only the
+#layers of the time steps that are actually simulated are ever loaded
+weatherSlice <- function(weatherData, band, varid = NA){
+  
+  if (extension(weatherData) == ".nc"){
+    nc <- nc_open(weatherData)
+    on.exit(nc_close(nc))
+    w <- ncvar_get(nc, varid = varid, start = c(1, 1, band), count = c(-1, -1, 1))
+  }else{
+    w <- as.matrix(raster(weatherData, band = band))
+  }
+  
+  w[is.na(w)] <- 0
+  return(w)
+  
+}
+
+
+#read a single band of the critical temperature data (one layer per year) instead of loading the whole stack
+critTempLayer <- function(critTempData, band){
+  
+  if (extension(critTempData) == ".nc"){
+    nc <- nc_open(critTempData)
+    on.exit(nc_close(nc))
+    crit <- ncvar_get(nc, start = c(1, 1, band), count = c(-1, -1, 1))
+  }else{
+    crit <- as.matrix(raster(critTempData, band = band))
+  }
+  
+  #missing temperatures never trigger mortality
+  storage.mode(crit) <- "double"
+  return(crit)
+  
+}
+
+
+#preprocess the host rasters (host1_rast, host2_rast, ... in that order), allTrees and initialPopulation of a study area
+#into a single binary landscape pack (missing values set to 0, checked to be aligned), loaded with landscapeLoad()
+landscapePack <- function(path, hosts, allTrees, initialPopulation){
+  
+  as_counts <- function(r){
+    m <- as.matrix(r)
+    m[is.na(m)] <- 0
+    storage.mode(m) <- "integer"
+    m
+  }
+  for (r in hosts) if (!compareRaster(r, allTrees, stopiffalse = FALSE)) stop('host rasters and allTrees must have the same extent and resolution')
+  if (!compareRaster(initialPopulation, allTrees, stopiffalse = FALSE)) stop('initialPopulation and allTrees must have the same extent and resolution')
+  ext <- extent(allTrees)
+  LandscapePackWriteCpp(path, lapply(hosts, as_counts), as_counts(allTrees), as_counts(initialPopulation),
+                        c(ext@xmin, ext@xmax, ext@ymin, ext@ymax), ifelse(is.na(projection(allTrees)), "", projection(allTrees)))
+  invisible(path)
+  
+}
+
+
+#map a landscape pack written by landscapePack(); the result is passed to pestJobStart(landscape = ...) in place of the
+#host rasters and can be reused by any number of runs
+landscapeLoad <- function(path, verify = TRUE){
+  
+  pack <- LandscapePackCpp(path, verify)
+  template <- raster(nrows = pack$nrow, ncols = pack$ncol, xmn = pack$extent[1], xmx = pack$extent[2],
+                     ymn = pack$extent[3], ymx = pack$extent[4], crs = if (pack$crs == "") NA else pack$crs)
+  structure(list(ptr = pack$ptr, number_of_hosts = pack$nhosts, template = template, checksum = pack$checksum),
+            class = "pestLandscape")
+  
+}
 
+
+#wind direction (degrees clockwise from north) or von Mises kappa of a single time step. windData is a raster/NetCDF
+#file with one layer per time step, or a table with one row per time step and one column per region of the zone grid
+#'zones' (matrix of region numbers 1..n, NA outside of every region). Missing values are kept: there the spores are
+#dispersed in every direction.
+windLayer <- function(windData, band, zones = NULL, varid = NA){
+  
+  if (is.null(zones)){
+    if (extension(windData) == ".nc"){
+      nc <- nc_open(windData)
+      on.exit(nc_close(nc))
+      w <- ncvar_get(nc, varid = varid, start = c(1, 1, band), count = c(-1, -1, 1))
+    }else{
+      w <- as.matrix(raster(windData, band = band))
+    }
+  }else{
+    if (band > nrow(windData)) stop('the wind table must have one row per time step')
+    w <- matrix(as.numeric(unlist(windData[band, ]))[zones], nrow = nrow(zones), ncol = ncol(zones))
+  }
+  
+  storage.mode(w) <- "double"
+  return(w)
+  
+}
+
+
+#zone index of polygons (states, counties, ...) on the grid of the runs: polygon k is rasterized once to zone k (cells
+#outside every polygon are 0) and the grid is kept in 'file' when one is given, so later sessions skip the overlay.
+#'field' names the zones (several fields are pasted together, e.g. county and state). Passed to pestJobStart(zones = list(name = index, ...)) or to zonalSummary().
+zoneIndex <- function(polygons, template, field, file = NULL){
+  
+  loadEngine()
+  if (!is.null(file) && file.exists(file)){
+    zones <- raster(file)
+    if (!compareRaster(zones, template, stopiffalse = FALSE)) stop(paste(file, 'does not have the extent and resolution of the template'))
+  }else{
+    if (!is.na(projection(template)) && !is.na(projection(polygons))) polygons <- spTransform(polygons, crs(template))
+    zones <- rasterize(polygons, template, field = seq_along(polygons), background = 0)
+    if (!is.null(file)) writeRaster(zones, file, datatype = "INT4S", overwrite = TRUE)
+  }
+  z <- as.matrix(zones)
+  z[is.na(z)] <- 0
+  storage.mode(z) <- "integer"
+  index <- ZoneIndexCpp(z, length(polygons))
+  names <- do.call(paste, c(lapply(field, function(f) as.character(polygons[[f]])), sep = ", "))
+  structure(list(ptr = index$ptr, names = names, cells = index$cells, template = template),
+            class = "pestZones")
+  
+}
+
+
+#infected individuals (sum, in thousands as in pest() and the data$zones tables of pestJobResult) and infected area of
+#every zone of a zone index for a raster on its grid (e.g. a layer of the output of pest()), zones without infection left out
+zonalSummary <- function(zones, x){
+  
+  if (!compareRaster(x, zones$template, stopiffalse = FALSE)) stop('the raster does not have the grid of the zone index')
+  out <- ZonalSumCpp(zones$ptr, as.matrix(x))
+  res_area <- res(x)[1]*res(x)[2]
+  summary <- data.frame(zone = seq_along(zones$names), name = zones$names, infectedIndividuals = out$sum/1000,
+                        infectedArea = out$cells*res_area, zoneArea = zones$cells*res_area, stringsAsFactors = FALSE)
+  summary[summary$infectedArea > 0, ]
+  
+}
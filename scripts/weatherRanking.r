@@ -1,36 +1,52 @@
 ##WEATHER RANKING:
-lst <- dir('D:\\SOD-modeling\\layers\\weather\\weatherCoeff_19902008_20082014PRISM', pattern='\\.img$', full.names=T)
-Mlst <- lst[grep("_m", lst)]
-Clst <- lst[grep("_c", lst)]
+## Ranks the years of a weekly coefficient archive by their mean weekly suitability (sum over cells of M * C) and writes
+## the ranking table used by climGen (year, values, rank). Weeks are read one layer at a time and summed natively
+## (WeatherRankAddCpp), optionally within a mask or per sub-region (zones: 0 = not counted, 1..n = regions).
+library(raster)
+library(Rcpp)
+source("scripts/engine_loader.r")
+loadEngine()
 
-years <- 1990:2014
-
-prod_mc_TOT <- rep(0, length(years))
-cnt <- 0
-
-for (yr in years){
+weatherRanking <- function(lst, years, mask = NULL, zones = NULL, output = NULL){
 	
-	cat(paste('year', yr), '\n')
-	cnt <- cnt + 1
-
-	Mlst_sel <- grep(paste0(as.character(yr),"_"), Mlst, value=TRUE)
-	Clst_sel <- grep(paste0(as.character(yr),"_"), Clst, value=TRUE)
+	Mlst <- lst[grep("_m", lst)]
+	Clst <- lst[grep("_c", lst)]
 	
-	Mstack <- stack(Mlst_sel) #M = moisture; 
-	Cstack <- stack(Clst_sel) #C = temperature;
+	first <- raster(Mlst[1])
+	if (!is.null(mask)) zones <- ifelse(is.na(as.matrix(mask)) | as.matrix(mask) == 0, 0L, 1L)
+	if (is.null(zones)){
+		ranking <- WeatherRankStartCpp(nrow(first), ncol(first))
+	}else{
+		zones <- as.matrix(zones)
+		zones[is.na(zones)] <- 0
+		ranking <- WeatherRankStartCpp(nrow(first), ncol(first), as.integer(zones), max(zones))
+	}
 	
-	prod_mc <- rep(0, nlayers(Mstack))
-
-	for (wk in 1:nlayers(Mstack)){
+	#layers of the files of a year, in order, read one at a time
+	layers <- function(files){
+		unlist(lapply(sort(files), function(f) lapply(seq_len(nbands(raster(f))), function(b) c(f, b))), recursive = FALSE)
+	}
+	
+	for (yr in years){
 		
-		cat(paste('week', wk), '\n')
-		prod_mc_ras <- Mstack[wk] * Cstack[wk]
-
-		#sum over all cells of the raster for current week
-		prod_mc[wk] <- sum(prod_mc_ras, na.rm=T)
+		cat(paste('year', yr), '\n')
+		
+		Mlayers <- layers(grep(paste0(as.character(yr),"_"), Mlst, value=TRUE)) #M = moisture;
+		Clayers <- layers(grep(paste0(as.character(yr),"_"), Clst, value=TRUE)) #C = temperature;
+		if (length(Mlayers) != length(Clayers)) stop(paste('M and C layers do not match for year', yr))
+		
+		for (wk in seq_along(Mlayers)){
+			M <- as.matrix(raster(Mlayers[[wk]][1], band = as.numeric(Mlayers[[wk]][2])))
+			C <- as.matrix(raster(Clayers[[wk]][1], band = as.numeric(Clayers[[wk]][2])))
+			WeatherRankAddCpp(ranking, yr, M, C)
+		}
 	}
 	
-	#sum over all weeks of the current year
-	prod_mc_TOT[cnt] <- mean(prod_mc, na.rm=T)
+	out <- WeatherRankTableCpp(ranking)
+	if (!is.null(output)) write.csv(out$ranking[out$ranking$region == 1, c("year", "values", "rank")], output, row.names = FALSE)
+	return(out)
+	
+}
 
-}
\ No newline at end of file
+# lst <- dir('D:\\SOD-modeling\\layers\\weather\\weatherCoeff_19902008_20082014PRISM', pattern='\\.img$', full.names=T)
+# weather_rank <- weatherRanking(lst, 1990:2014, output = 'layers/weather/WeatherRanked.csv')